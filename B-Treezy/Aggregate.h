@@ -0,0 +1,93 @@
+/*****************************************************************//**
+ * \file   Aggregate.h
+ * \brief  Monoids summarizing the values of a subtree
+ * 
+ * \author Kkobari
+ * \date   November 2022
+ *********************************************************************/
+
+#pragma once
+#include <algorithm>
+#include <limits>
+#include "Multiset.h"
+
+using namespace std;
+
+/*
+ * A monoid tells the tree how to summarize its values. It provides:
+ *   Value                    - the type of the summary
+ *   enabled                  - whether the tree keeps summaries at all
+ *   Identity()               - the summary of no values
+ *   Lift(value)              - the summary of a single value
+ *   Combine(left, right)     - the summary of two neighbouring summaries, left holding the lower values
+ */
+
+/**
+ * \brief The default monoid, the tree keeps no summaries.
+ */
+template <class T>
+struct NoAggregate
+{
+	typedef char Value;
+	static constexpr bool enabled = false;
+
+	static Value Identity() { return 0; }
+	static Value Lift(const T& value) { return 0; }
+	static Value Combine(const Value& left, const Value& right) { return 0; }
+};
+
+/**
+ * \brief Summarizes the values by their sum.
+ */
+template <class T>
+struct SumAggregate
+{
+	typedef T Value;
+	static constexpr bool enabled = true;
+
+	static Value Identity() { return T(); }
+	static Value Lift(const T& value) { return value; }
+	static Value Combine(const Value& left, const Value& right) { return left + right; }
+};
+
+/**
+ * \brief Summarizes the values by their minimum.
+ */
+template <class T>
+struct MinAggregate
+{
+	typedef T Value;
+	static constexpr bool enabled = true;
+
+	static Value Identity() { return numeric_limits<T>::max(); }
+	static Value Lift(const T& value) { return value; }
+	static Value Combine(const Value& left, const Value& right) { return min(left, right); }
+};
+
+/**
+ * \brief Summarizes the values by their maximum.
+ */
+template <class T>
+struct MaxAggregate
+{
+	typedef T Value;
+	static constexpr bool enabled = true;
+
+	static Value Identity() { return numeric_limits<T>::lowest(); }
+	static Value Lift(const T& value) { return value; }
+	static Value Combine(const Value& left, const Value& right) { return max(left, right); }
+};
+
+/**
+ * \brief Summarizes the values by their count, counted values and posting lists by all their repeats.
+ */
+template <class T>
+struct CountAggregate
+{
+	typedef long long Value;
+	static constexpr bool enabled = true;
+
+	static Value Identity() { return 0; }
+	static Value Lift(const T& value) { return MultisetTraits<T>::Multiplicity(value); }
+	static Value Combine(const Value& left, const Value& right) { return left + right; }
+};
@@ -0,0 +1,478 @@
+/*****************************************************************//**
+ * \file   AsyncIO.cpp
+ * \brief  Asynchronous reads from a file, through io_uring or a thread pool
+ * 
+ * \author Kkobari
+ * \date   November 2022
+ *********************************************************************/
+
+#include "AsyncIO.h"
+#include <fstream>
+#include <atomic>
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <cstring>
+#endif
+
+/**
+ * Constructs the reader.
+ * 
+ * \param queueDepth The most reads in flight at once
+ */
+AsyncReader::AsyncReader(int queueDepth)
+{
+	this->queueDepth = queueDepth < 1 ? 1 : queueDepth;
+}
+
+/**
+ * Destructs the reader.
+ */
+AsyncReader::~AsyncReader()
+{
+}
+
+/**
+ * Opens a file for asynchronous reading, through io_uring where available, on a thread pool otherwise.
+ * 
+ * \param path The path of the file
+ * \param queueDepth The most reads in flight at once
+ * \param useUring Whether to try io_uring first
+ * \return The reader, nullptr if the file can't be opened
+ */
+unique_ptr<AsyncReader> AsyncReader::Open(const string& path, int queueDepth, bool useUring)
+{
+#ifdef __linux__
+	if (useUring)
+	{
+		unique_ptr<UringReader> reader(new UringReader(queueDepth));
+		if (reader->Open(path))
+			return reader;
+	}
+#endif
+
+	if (!ifstream(path, ios::binary))
+		return nullptr;
+
+	return unique_ptr<AsyncReader>(new ThreadPoolReader(path, queueDepth));
+}
+
+/**
+ * Issues the waiting reads while there is room in the queue.
+ */
+void AsyncReader::IssuePending()
+{
+	while (inFlight < queueDepth && !pending.empty())
+	{
+		Request request = move(pending.front());
+		pending.pop_front();
+
+		inFlight++;
+		Issue(request);
+	}
+}
+
+/**
+ * Submits a read. It is issued right away if there is room in the queue, later otherwise.
+ * 
+ * \param offset Where in the file to read from
+ * \param size The number of bytes to read
+ * \param buffer Where to read to, must stay valid until the read completes
+ * \param done Called from Poll with whether all bytes were read
+ */
+void AsyncReader::Submit(long long offset, int size, char* buffer, const function<void(bool)>& done)
+{
+	pending.push_back(Request{ offset, size, buffer, done });
+	IssuePending();
+}
+
+/**
+ * Calls the callbacks of the completed reads and issues the waiting ones.
+ * 
+ * \param wait Whether to wait for at least one read to complete
+ * \return The number of completed reads
+ */
+int AsyncReader::Poll(bool wait)
+{
+	IssuePending();
+
+	if (inFlight == 0)
+		return 0;
+
+	int count = Complete(wait);
+
+	// the callbacks may have submitted more
+	IssuePending();
+
+	return count;
+}
+
+/**
+ * Completes reads until none are left, including the ones submitted by the callbacks.
+ */
+void AsyncReader::Run()
+{
+	while (inFlight > 0 || !pending.empty())
+		Poll(true);
+}
+
+/**
+ * Gets the number of reads in flight.
+ * 
+ * \return The number of reads
+ */
+int AsyncReader::GetInFlight()
+{
+	return inFlight;
+}
+
+/**
+ * Gets the number of reads completed so far.
+ * 
+ * \return The number of reads
+ */
+long long AsyncReader::GetCompletedCount()
+{
+	return completedCount;
+}
+
+/**
+ * Constructs the reader with a worker for every read in flight.
+ * 
+ * \param path The path of the file
+ * \param queueDepth The most reads in flight at once
+ */
+ThreadPoolReader::ThreadPoolReader(const string& path, int queueDepth) : AsyncReader(queueDepth), pool(queueDepth < 1 ? 1 : queueDepth)
+{
+	static atomic<long long> nextId(0);
+
+	this->path = path;
+	this->id = nextId++;
+}
+
+/**
+ * Waits for the reads in flight, their buffers must not be written after the reader is gone.
+ */
+ThreadPoolReader::~ThreadPoolReader()
+{
+	unique_lock<mutex> lock(completedMutex);
+	completedReady.wait(lock, [&] { return (int)completed.size() == inFlight; });
+}
+
+/**
+ * Hands a read over to a worker.
+ * 
+ * \param request The read
+ */
+void ThreadPoolReader::Issue(Request& request)
+{
+	long long id = this->id;
+	string path = this->path;
+
+	pool.Submit([this, id, path, request]()
+	{
+		// each worker keeps its own stream of every file it read from
+		thread_local vector<pair<long long, unique_ptr<ifstream>>> streams;
+
+		ifstream* stream = nullptr;
+		for (auto& entry : streams)
+		{
+			if (entry.first == id)
+				stream = entry.second.get();
+		}
+		if (stream == nullptr)
+		{
+			streams.push_back(make_pair(id, unique_ptr<ifstream>(new ifstream(path, ios::binary))));
+			stream = streams.back().second.get();
+		}
+
+		stream->clear();
+		stream->seekg(request.offset);
+		stream->read(request.buffer, request.size);
+		bool read = stream->gcount() == request.size;
+
+		lock_guard<mutex> lock(completedMutex);
+		completed.push_back(make_pair(request.done, read));
+		completedReady.notify_all();
+	});
+}
+
+/**
+ * Calls the callbacks of the reads the workers are done with.
+ * 
+ * \param wait Whether to wait for at least one read to complete
+ * \return The number of completed reads
+ */
+int ThreadPoolReader::Complete(bool wait)
+{
+	vector<pair<function<void(bool)>, bool>> done;
+	{
+		unique_lock<mutex> lock(completedMutex);
+		if (wait)
+			completedReady.wait(lock, [&] { return !completed.empty(); });
+
+		done.swap(completed);
+	}
+
+	for (auto& read : done)
+	{
+		inFlight--;
+		completedCount++;
+		read.first(read.second);
+	}
+
+	return done.size();
+}
+
+#ifdef __linux__
+/**
+ * Sets up the ring, it can fail if the kernel doesn't support io_uring - see Open.
+ * 
+ * \param queueDepth The most reads in flight at once
+ */
+UringReader::UringReader(int queueDepth) : AsyncReader(queueDepth)
+{
+	io_uring_params params;
+	memset(&params, 0, sizeof(params));
+
+	ring = syscall(__NR_io_uring_setup, this->queueDepth, &params);
+	if (ring < 0)
+		return;
+
+	submissionMapSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	completionMapSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+	// newer kernels map both queues at once
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+		submissionMapSize = completionMapSize = max(submissionMapSize, completionMapSize);
+
+	submissionMap = mmap(nullptr, submissionMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQ_RING);
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+		completionMap = submissionMap;
+	else
+		completionMap = mmap(nullptr, completionMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_CQ_RING);
+
+	entriesMapSize = params.sq_entries * sizeof(io_uring_sqe);
+	entriesMap = mmap(nullptr, entriesMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQES);
+
+	if (submissionMap == MAP_FAILED || completionMap == MAP_FAILED || entriesMap == MAP_FAILED)
+	{
+		// the mappings which did succeed are released before falling back
+		if (entriesMap != MAP_FAILED)
+			munmap(entriesMap, entriesMapSize);
+		if (completionMap != MAP_FAILED && completionMap != submissionMap)
+			munmap(completionMap, completionMapSize);
+		if (submissionMap != MAP_FAILED)
+			munmap(submissionMap, submissionMapSize);
+
+		close(ring);
+		ring = -1;
+		return;
+	}
+
+	char* submission = (char*)submissionMap;
+	submissionTail = (unsigned*)(submission + params.sq_off.tail);
+	submissionMask = (unsigned*)(submission + params.sq_off.ring_mask);
+	submissionArray = (unsigned*)(submission + params.sq_off.array);
+	entries = entriesMap;
+
+	char* completion = (char*)completionMap;
+	completionHead = (unsigned*)(completion + params.cq_off.head);
+	completionTail = (unsigned*)(completion + params.cq_off.tail);
+	completionMask = (unsigned*)(completion + params.cq_off.ring_mask);
+	completions = completion + params.cq_off.cqes;
+
+	slots.resize(this->queueDepth);
+	vectors.resize(this->queueDepth);
+	for (int i = this->queueDepth - 1; i >= 0; i--)
+		freeSlots.push_back(i);
+}
+
+/**
+ * Waits for the reads in flight and releases the ring. Reads the ring failed are not waited for.
+ */
+UringReader::~UringReader()
+{
+	if (ring >= 0)
+	{
+		while (inFlight > 0)
+			Complete(true);
+
+		munmap(entriesMap, entriesMapSize);
+		if (completionMap != submissionMap)
+			munmap(completionMap, completionMapSize);
+		munmap(submissionMap, submissionMapSize);
+		close(ring);
+	}
+
+	if (file >= 0)
+		close(file);
+}
+
+/**
+ * Opens the file to read from.
+ * 
+ * \param path The path of the file
+ * \return False if the ring couldn't be set up or the file can't be opened
+ */
+bool UringReader::Open(const string& path)
+{
+	if (ring < 0)
+		return false;
+
+	file = open(path.c_str(), O_RDONLY);
+	return file >= 0;
+}
+
+/**
+ * Adds a read to the submission queue, it is submitted with the next Complete.
+ * 
+ * \param request The read
+ */
+void UringReader::Issue(Request& request)
+{
+	int slot = freeSlots.back();
+	freeSlots.pop_back();
+
+	slots[slot] = move(request);
+	vectors[slot].iov_base = slots[slot].buffer;
+	vectors[slot].iov_len = slots[slot].size;
+
+	unsigned tail = *submissionTail;
+	unsigned index = tail & *submissionMask;
+
+	io_uring_sqe* entry = (io_uring_sqe*)entries + index;
+	memset(entry, 0, sizeof(*entry));
+	entry->opcode = IORING_OP_READV;
+	entry->fd = file;
+	entry->addr = (unsigned long long)&vectors[slot];
+	entry->len = 1;
+	entry->off = slots[slot].offset;
+	entry->user_data = slot;
+
+	submissionArray[index] = index;
+	__atomic_store_n(submissionTail, tail + 1, __ATOMIC_RELEASE);
+	unsubmitted++;
+}
+
+/**
+ * Calls the callbacks of the reads in the completion queue.
+ * 
+ * \return The number of completed reads
+ */
+int UringReader::Reap()
+{
+	int count = 0;
+
+	while (true)
+	{
+		unsigned head = *completionHead;
+		if (head == __atomic_load_n(completionTail, __ATOMIC_ACQUIRE))
+			return count;
+
+		io_uring_cqe* entry = (io_uring_cqe*)completions + (head & *completionMask);
+		int slot = entry->user_data;
+		bool read = entry->res == slots[slot].size;
+
+		// the entry is handed back before the callback, which may issue more reads
+		__atomic_store_n(completionHead, head + 1, __ATOMIC_RELEASE);
+
+		function<void(bool)> done = move(slots[slot].done);
+		freeSlots.push_back(slot);
+		inFlight--;
+		completedCount++;
+		count++;
+
+		done(read);
+	}
+}
+
+/**
+ * Submits the queued reads and calls the callbacks of the completed ones, in a single system call.
+ * 
+ * \param wait Whether to wait for at least one read to complete
+ * \return The number of completed reads, including the ones failed because the ring returned an error
+ */
+int UringReader::Complete(bool wait)
+{
+	if (broken)
+		return Fail();
+
+	int count = Reap();
+
+	if (unsubmitted > 0 || (wait && count == 0))
+	{
+		unsigned waitFor = wait && count == 0 ? 1 : 0;
+		unsigned flags = waitFor > 0 ? IORING_ENTER_GETEVENTS : 0;
+
+		int submitted;
+		do
+		{
+			submitted = syscall(__NR_io_uring_enter, ring, unsubmitted, waitFor, flags, nullptr, 0);
+		} while (submitted < 0 && errno == EINTR);
+
+		if (submitted < 0)
+		{
+			// a ring which can't even wait for completions won't deliver them anymore
+			broken = unsubmitted == 0;
+			return count + Fail();
+		}
+
+		unsubmitted -= submitted;
+		count += Reap();
+	}
+
+	return count;
+}
+
+/**
+ * Fails reads after the ring returned an error, calling their callbacks with false. The kernel takes none
+ * of the new reads when it returns an error, so those are taken back out of the submission queue, while
+ * the reads it took before stay in flight. Once the ring is broken, those are given up on too,
+ * so no caller waits for them forever.
+ * 
+ * \return The number of failed reads
+ */
+int UringReader::Fail()
+{
+	vector<int> failed;
+
+	unsigned tail = *submissionTail;
+	for (unsigned i = tail - unsubmitted; i != tail; i++)
+		failed.push_back(((io_uring_sqe*)entries)[i & *submissionMask].user_data);
+
+	__atomic_store_n(submissionTail, tail - unsubmitted, __ATOMIC_RELEASE);
+	unsubmitted = 0;
+
+	if (broken)
+	{
+		vector<bool> free(slots.size(), false);
+		for (int slot : freeSlots)
+			free[slot] = true;
+
+		failed.clear();
+		for (int slot = 0; slot < (int)slots.size(); slot++)
+		{
+			if (!free[slot])
+				failed.push_back(slot);
+		}
+	}
+
+	for (int slot : failed)
+	{
+		function<void(bool)> done = move(slots[slot].done);
+		freeSlots.push_back(slot);
+		inFlight--;
+		completedCount++;
+
+		done(false);
+	}
+
+	return failed.size();
+}
+#endif
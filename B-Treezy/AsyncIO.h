@@ -0,0 +1,182 @@
+/*****************************************************************//**
+ * \file   AsyncIO.h
+ * \brief  Asynchronous reads from a file, through io_uring or a thread pool
+ * 
+ * The reads are completed on the thread calling Poll, so the callbacks need no locking
+ * and may submit more reads themselves.
+ * 
+ * \author Kkobari
+ * \date   November 2022
+ *********************************************************************/
+
+#pragma once
+#include <functional>
+#include <memory>
+#include <string>
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include "ThreadPool.h"
+#ifdef __linux__
+#include <sys/uio.h>
+#endif
+
+using namespace std;
+
+/**
+ * \brief Reads parts of a file asynchronously, keeping up to a number of reads in flight.
+ */
+class AsyncReader
+{
+protected:
+	/**
+	 * \brief A read waiting to be issued or in flight.
+	 */
+	struct Request
+	{
+		/** Where in the file to read from */
+		long long offset;
+		/** The number of bytes to read */
+		int size;
+		/** Where to read to */
+		char* buffer;
+		/** Called with whether all bytes were read */
+		function<void(bool)> done;
+	};
+
+	/** The most reads in flight at once */
+	int queueDepth;
+	/** The reads in flight */
+	int inFlight = 0;
+	/** The reads submitted while the queue was full */
+	deque<Request> pending;
+	/** The number of reads completed */
+	long long completedCount = 0;
+
+	/**
+	 * Issues a read to the device.
+	 * 
+	 * \param request The read
+	 */
+	virtual void Issue(Request& request) = 0;
+
+	/**
+	 * Calls the callbacks of the completed reads.
+	 * 
+	 * \param wait Whether to wait for at least one read to complete
+	 * \return The number of completed reads
+	 */
+	virtual int Complete(bool wait) = 0;
+
+	void IssuePending();
+
+public:
+	AsyncReader(int queueDepth);
+	virtual ~AsyncReader();
+
+	static unique_ptr<AsyncReader> Open(const string& path, int queueDepth, bool useUring = true);
+
+	void Submit(long long offset, int size, char* buffer, const function<void(bool)>& done);
+	int Poll(bool wait);
+	void Run();
+
+	int GetInFlight();
+	long long GetCompletedCount();
+
+	/**
+	 * Gets the name of the backend.
+	 * 
+	 * \return "io_uring" or "threads"
+	 */
+	virtual const char* GetName() = 0;
+};
+
+/**
+ * \brief Reads on a thread pool, each worker with its own stream of the file. Works everywhere.
+ */
+class ThreadPoolReader : public AsyncReader
+{
+private:
+	/** The path of the file */
+	string path;
+	/** Identifies the reader in the per-thread streams, addresses could be reused */
+	long long id;
+	/** The workers doing the blocking reads, one per read in flight */
+	ThreadPool pool;
+
+	/** The reads done by the workers, waiting for their callbacks */
+	vector<pair<function<void(bool)>, bool>> completed;
+	/** Guards the completed reads */
+	mutex completedMutex;
+	/** Signals a completed read */
+	condition_variable completedReady;
+
+protected:
+	void Issue(Request& request) override;
+	int Complete(bool wait) override;
+
+public:
+	ThreadPoolReader(const string& path, int queueDepth);
+	~ThreadPoolReader();
+
+	const char* GetName() override { return "threads"; }
+};
+
+#ifdef __linux__
+/**
+ * \brief Reads through an io_uring submission and completion queue. Linux only.
+ */
+class UringReader : public AsyncReader
+{
+private:
+	/** The file read from */
+	int file = -1;
+	/** The ring */
+	int ring = -1;
+
+	/** The mapped submission queue, its entries and the completion queue */
+	void* submissionMap = nullptr;
+	void* entriesMap = nullptr;
+	void* completionMap = nullptr;
+	size_t submissionMapSize = 0;
+	size_t entriesMapSize = 0;
+	size_t completionMapSize = 0;
+
+	/** The pointers into the mapped queues */
+	unsigned* submissionTail;
+	unsigned* submissionMask;
+	unsigned* submissionArray;
+	void* entries;
+	unsigned* completionHead;
+	unsigned* completionTail;
+	unsigned* completionMask;
+	void* completions;
+
+	/** The reads in flight, indexed by the slot passed with them */
+	vector<Request> slots;
+	/** The free slots */
+	vector<int> freeSlots;
+	/** The buffer descriptions of the slots */
+	vector<iovec> vectors;
+	/** The number of reads added to the submission queue but not yet submitted */
+	unsigned unsubmitted = 0;
+	/** Whether the ring failed to wait for completions, every read is failed from then on */
+	bool broken = false;
+
+	int Reap();
+	int Fail();
+
+protected:
+	void Issue(Request& request) override;
+	int Complete(bool wait) override;
+
+public:
+	UringReader(int queueDepth);
+	~UringReader();
+
+	bool Open(const string& path);
+
+	const char* GetName() override { return "io_uring"; }
+};
+#endif
@@ -14,8 +14,8 @@
  * 
  * \param order The order of the tree
  */
-template <class T>
-BTree<T>::BTree(int order)
+template <class T, class Monoid>
+BTree<T, Monoid>::BTree(int order)
 {
 	if (order < 3)
 	{
@@ -32,8 +32,8 @@ BTree<T>::BTree(int order)
 /**
  * Destructs the tree.
  */
-template <class T>
-BTree<T>::~BTree()
+template <class T, class Monoid>
+BTree<T, Monoid>::~BTree()
 {
 	delete root;
 }
@@ -44,25 +44,42 @@ BTree<T>::~BTree()
  * 
  * \param node The node to insert into
  * \param value	The value to insert
+ * \return False if the value was already present and couldn't be counted into the stored one
  */
-template <class T>
-void BTree<T>::InternalInsert(Node* node, T value)
+template <class T, class Monoid>
+bool BTree<T, Monoid>::InternalInsert(Node* node, T value)
 {
 	// if tree is empty
 	if (this->root == nullptr)
 	{
-		// creates a new root
+		// creates a new root, whatever emptied the tree left no hot nodes behind
+		this->hotNodes = 0;
 		Node* newNode = new Node(value, nullptr);
 		this->root = newNode;
+		this->height = 1;
+		RefreshSummary(newNode);
+		BTREE_COUNT(allocations, 1);
+		BTREE_COUNT(rootGrows, 1);
+		Trace(TraceEventType::RootGrow, newNode);
 
-		return;
+		return true;
 	}
 
-	// checks if this value is already present - no duplicates allowed
+	Touch(node);
+	BTREE_COUNT(nodesVisited, 1);
+	BTREE_COUNT(comparisons, min<int>(node->GetValueIndex(value) + 1, node->values.size()));
+
+	// checks if this value is already present - no duplicates allowed, unless it can be counted into the stored one
 	if (node->CheckValuePresent(value))
 	{
-		cout << "This value is already present" << endl;
-		return;
+		if (MultisetTraits<T>::enabled)
+		{
+			MultisetTraits<T>::Add(node->values[node->GetValueIndex(value)], value);
+			RefreshPath(node);
+			return true;
+		}
+
+		return false;
 	}
 
 	// if node is leaf
@@ -74,24 +91,19 @@ void BTree<T>::InternalInsert(Node* node, T value)
 		// then we have to check if this leaf has overflown
 		InternalSplit(node);
 
-		return;
+		return true;
 	}
 
-	// if node has children
-	if (!node->IsLeaf())
+	// node has children, choose correct branch to go down
+	for (int i = 0; i < node->values.size(); i++)
 	{
-		// choose correct branch to go down
-		for (int i = 0; i < node->values.size(); i++)
+		BTREE_COUNT(comparisons, 1);
+		if (value < node->values[i])
 		{
-			if (value < node->values[i])
-			{
-				InternalInsert(node->children[i], value);
-				return;
-			}
+			return InternalInsert(node->children[i], value);
 		}
-		InternalInsert(node->children[node->values.size()], value);
-		return;
 	}
+	return InternalInsert(node->children[node->values.size()], value);
 }
 
 /**
@@ -99,12 +111,13 @@ void BTree<T>::InternalInsert(Node* node, T value)
  * 
  * \param node The node to split
  */
-template <class T>
-void BTree<T>::InternalSplit(Node* node)
+template <class T, class Monoid>
+void BTree<T, Monoid>::InternalSplit(Node* node)
 {
 	// if node has allowed number of values, we don't have to split
 	if (node->values.size() < order)
 	{
+		RefreshPath(node);
 		return;
 	}
 
@@ -117,8 +130,15 @@ void BTree<T>::InternalSplit(Node* node)
 		this->root = newRoot;
 		newRoot->children.push_back(node);
 		this->root->Adopt();
+		this->height++;
+		BTREE_COUNT(allocations, 1);
+		BTREE_COUNT(rootGrows, 1);
+		Trace(TraceEventType::RootGrow, newRoot);
 	}
 
+	this->structuralChanges++;
+	BTREE_COUNT(splits, 1);
+
 	int middleIndex = floor((order - 1) / 2);
 
 	// push the middle value into parent
@@ -126,6 +146,7 @@ void BTree<T>::InternalSplit(Node* node)
 
 	// create a new right node and push right values into it
 	Node* newRight = new Node();
+	BTREE_COUNT(allocations, 1);
 	newRight->parent = node->parent;
 	for (int i = middleIndex + 1; i < node->values.size(); i++)
 	{
@@ -152,6 +173,10 @@ void BTree<T>::InternalSplit(Node* node)
 	// push new right node into parent.children after original node (to keep their order)
 	node->parent->children.insert(next(find(node->parent->children.begin(), node->parent->children.end(), node)), newRight);
 
+	RefreshSummary(node);
+	RefreshSummary(newRight);
+	Trace(TraceEventType::Split, node);
+
 	// now call InternalSplit on parent to make sure it didn't overflow too
 	InternalSplit(node->parent);
 }
@@ -163,9 +188,13 @@ void BTree<T>::InternalSplit(Node* node)
  * \param value The value to check for
  * \return True if the value is present, false otherwise
  */
-template <class T>
-bool BTree<T>::InternalFind(Node* node, T value)
+template <class T, class Monoid>
+bool BTree<T, Monoid>::InternalFind(Node* node, T value)
 {
+	Touch(node);
+	BTREE_COUNT(nodesVisited, 1);
+	BTREE_COUNT(comparisons, min<int>(node->GetValueIndex(value) + 1, node->values.size()));
+
 	// check if current node has the value
 	if (node->CheckValuePresent(value))
 		return true;
@@ -177,6 +206,7 @@ bool BTree<T>::InternalFind(Node* node, T value)
 	// if node has children we find the correct one to search
 	for (int i = 0; i < node->values.size(); i++)
 	{
+		BTREE_COUNT(comparisons, 1);
 		if (value < node->values[i])
 		{
 			return InternalFind(node->children[i], value);
@@ -190,32 +220,44 @@ bool BTree<T>::InternalFind(Node* node, T value)
  * 
  * \param node The node to remove from
  * \param value The value to remove
+ * \return False if the value was not present
  */
-template <class T>
-void BTree<T>::InternalRemove(Node* node, T value)
+template <class T, class Monoid>
+bool BTree<T, Monoid>::InternalRemove(Node* node, T value)
 {
+	Touch(node);
+	BTREE_COUNT(nodesVisited, 1);
+	BTREE_COUNT(comparisons, min<int>(node->GetValueIndex(value) + 1, node->values.size()));
+
 	// if value is present in this node
 	if (node->CheckValuePresent(value))
 	{
+		// a counted value only goes away once nothing is left of it
+		if (MultisetTraits<T>::enabled && MultisetTraits<T>::Subtract(node->values[node->GetValueIndex(value)], value))
+		{
+			RefreshPath(node);
+			return true;
+		}
+
 		if (node->IsLeaf())
 		{
 			// if node is leaf, just remove the value and then rebalance from leaf
 			node->RemoveValue(value);
 			InternalRebalance(node);
-			return;
+			return true;
 		}
 		else
 		{
 			// if node is internal, replace deleted value with the closest value
-			int minAllowed = floor((order - 1) / 2);
+			int minAllowed = GetMinAllowed();
 
-			Node* closestLeftLeaf = node->children[node->GetValueIndex(value)]->GetMostRightChild();
-			Node* closestRightLeaf = node->children[node->GetValueIndex(value) + 1]->GetMostLeftChild();
+			Node* closestLeftLeaf = ThawedMostRight(node->children[node->GetValueIndex(value)]);
+			Node* closestRightLeaf = ThawedMostLeft(node->children[node->GetValueIndex(value) + 1]);
 
 			if (closestRightLeaf->values.size() > minAllowed)
 			{
 				// steal the closest right value and put it instead of the separator (value)
-				int stolenValue = *(closestRightLeaf->values.begin());
+				T stolenValue = *(closestRightLeaf->values.begin());
 				replace(node->values.begin(), node->values.end(), value, stolenValue);
 				closestRightLeaf->values.erase(closestRightLeaf->values.begin());
 
@@ -225,14 +267,14 @@ void BTree<T>::InternalRemove(Node* node, T value)
 			else
 			{
 				// steal the closest left value and put it instead of the separator (value)
-				int stolenValue = *(closestLeftLeaf->values.end() - 1);
+				T stolenValue = *(closestLeftLeaf->values.end() - 1);
 				replace(node->values.begin(), node->values.end(), value, stolenValue);
 				closestLeftLeaf->values.erase(closestLeftLeaf->values.end() - 1);
 
 				// we stole one value so we have to rebalance the leaf
 				InternalRebalance(closestLeftLeaf);
 			}
-			return;
+			return true;
 		}
 	}
 	// if value is not present
@@ -241,8 +283,7 @@ void BTree<T>::InternalRemove(Node* node, T value)
 		// if we reached the bottom of the tree
 		if (node->IsLeaf())
 		{
-			cout << "This value is not present" << endl;
-			return;
+			return false;
 		}
 		// if node is internal
 		else
@@ -250,14 +291,13 @@ void BTree<T>::InternalRemove(Node* node, T value)
 			// call Remove on the correct child
 			for (int i = 0; i < node->values.size(); i++)
 			{
+				BTREE_COUNT(comparisons, 1);
 				if (value < node->values[i])
 				{
-					InternalRemove(node->children[i], value);
-					return;
+					return InternalRemove(node->children[i], value);
 				}
 			}
-			InternalRemove(node->children[node->values.size()], value);
-			return;
+			return InternalRemove(node->children[node->values.size()], value);
 		}
 	}
 }
@@ -267,14 +307,17 @@ void BTree<T>::InternalRemove(Node* node, T value)
  *
  * \param node The node to rebalance
  */
-template <class T>
-void BTree<T>::InternalRebalance(Node* node)
+template <class T, class Monoid>
+void BTree<T, Monoid>::InternalRebalance(Node* node)
 {
-	int minAllowed = floor((order - 1) / 2);
+	int minAllowed = GetMinAllowed();
 
 	// if node has enough values, we don't have to rebalance
 	if (node->values.size() >= minAllowed)
+	{
+		RefreshPath(node);
 		return;
+	}
 
 	// if node is root we have to check if it wasn't robbed by its children merging in a previous rebalance
 	if (node == this->root)
@@ -287,24 +330,41 @@ void BTree<T>::InternalRebalance(Node* node)
 			{
 				delete node;
 				this->root = nullptr;
+				this->height = 0;
 			}
 			// if the root is empty, its only child will become the new root - the tree is now 1 level shorter
 			else
 			{
 				this->root = node->children[0];
+				this->root->parent = nullptr;
+				this->height--;
+				BTREE_COUNT(rootShrinks, 1);
+				Trace(TraceEventType::RootShrink, this->root);
+
+				// the old root must not take its child down with it
+				node->children.clear();
 				delete node;
 			}
 		}
+
+		if (this->root != nullptr)
+			RefreshSummary(this->root);
 		return;
 	}
 
 	Node* leftSibling = node->GetLeftSibling();
 	Node* rightSibling = node->GetRightSibling();
 
+	// the siblings give up values or take in the node's
+	if (leftSibling != nullptr)
+		Touch(leftSibling);
+	if (rightSibling != nullptr)
+		Touch(rightSibling);
+
 	// if node has a left sibling it can borrow a value from
 	if (leftSibling != nullptr && leftSibling->values.size() > minAllowed)
 	{
-		int separator = node->parent->values[node->GetIndex() - 1];
+		T separator = node->parent->values[node->GetIndex() - 1];
 
 		// put separator from parent into node instead of deleted value
 		node->values.insert(node->values.begin(), separator);
@@ -321,6 +381,12 @@ void BTree<T>::InternalRebalance(Node* node)
 			node->Adopt();
 		}
 
+		RefreshSummary(leftSibling);
+		RefreshSummary(node);
+		this->structuralChanges++;
+		BTREE_COUNT(borrowsLeft, 1);
+		Trace(TraceEventType::BorrowLeft, node);
+
 		// rebalance parent in case of underflow - should't happen but just in case
 		InternalRebalance(node->parent);
 		return;
@@ -328,7 +394,7 @@ void BTree<T>::InternalRebalance(Node* node)
 	// if node has a right sibling it can borrow a value from
 	else if (rightSibling != nullptr && rightSibling->values.size() > minAllowed)
 	{
-		int separator = node->parent->values[node->GetIndex()];
+		T separator = node->parent->values[node->GetIndex()];
 
 		// put separator from parent into node instead of deleted value
 		node->values.insert(node->values.end(), separator);
@@ -340,11 +406,17 @@ void BTree<T>::InternalRebalance(Node* node)
 		// if node has children, push the left child from sibling to the back of node children
 		if (!node->IsLeaf())
 		{
-			node->children.insert(node->children.end() - 1, *(rightSibling->children.begin()));
+			node->children.insert(node->children.end(), *(rightSibling->children.begin()));
 			rightSibling->children.erase(rightSibling->children.begin());
 			node->Adopt();
 		}
 
+		RefreshSummary(rightSibling);
+		RefreshSummary(node);
+		this->structuralChanges++;
+		BTREE_COUNT(borrowsRight, 1);
+		Trace(TraceEventType::BorrowRight, node);
+
 		// rebalance parent in case of underflow - should't happen but just in case
 		InternalRebalance(node->parent);
 		return;
@@ -368,7 +440,7 @@ void BTree<T>::InternalRebalance(Node* node)
 		}
 
 		// separator is the value in parent which separates the two nodes
-		int separator = left->parent->values[left->GetIndex()];
+		T separator = left->parent->values[left->GetIndex()];
 
 		// put separator into left
 		left->PushValue(separator);
@@ -391,243 +463,3197 @@ void BTree<T>::InternalRebalance(Node* node)
 		right->children.clear();
 		delete right;
 
+		RefreshSummary(left);
+		this->structuralChanges++;
+		BTREE_COUNT(merges, 1);
+		Trace(TraceEventType::Merge, left);
+
 		// call rebalance on parent - we just stole one value from it
 		InternalRebalance(left->parent);
 	}
 }
 
 /**
- * Prints a node and all its children.
+ * Gets the minimal number of values a node other than the root has to keep.
  * 
- * \param node The node to print
- * \param indent The number of spaces and characters to indent the node
- * \param last Whether the node is the last child of its parent
- * \param siblings The number of siblings the node has
- * \param position The position of the node in its parent
+ * \return The minimal number of values
  */
-template <class T>
-void BTree<T>::InternalPrint(Node* node, string indent, bool last, int siblings, int position)
+template <class T, class Monoid>
+int BTree<T, Monoid>::GetMinAllowed()
 {
-	// \xB3 = |
-	// \xC3 = T
-	// \xC0 = L
-	// \xC4 = -
+	// relaxed deletion only rebalances nodes which were emptied, unless they are being compacted
+	if (this->relaxedDeletion && !this->compacting)
+		return 1;
 
-	// if tree is empty
-	if (this->root == nullptr)
-	{
-		cout << "Tree is empty" << endl;
-		return;
-	}
+	return floor((order - 1) / 2);
+}
 
-	// last child needs a different symbol
-	cout << indent;
-	if (last)
-	{
-		if (siblings != 0)
-			cout << "\xC0\xC4";
-		indent.append("   ");
-	}
-	else
+/**
+ * Finds the node which holds a value.
+ * 
+ * \param node The node to start the search from
+ * \param value The value to look for
+ * \return The node holding the value, nullptr if the value is not present
+ */
+template <class T, class Monoid>
+typename BTree<T, Monoid>::Node* BTree<T, Monoid>::InternalFindNode(Node* node, T value)
+{
+	while (node != nullptr)
 	{
-		cout << "\xC3\xC4";
-		indent.append("\xB3  ");
-	}
+		Touch(node);
 
-	// for the node
-	if (siblings == 0)
-	{
-		cout << CYAN << "Root: " << RESET;
-		node->PrintValues();
-	}
-	else
-	{
-		cout << CYAN << " " << position + 1 << ": " << RESET;
-		node->PrintValues();
-	}
+		if (node->CheckValuePresent(value))
+			return node;
 
-	// print all node children
-	for (int i = 0; i < node->children.size(); i++)
-	{
-		InternalPrint(node->children[i], indent, i == node->children.size() - 1, node->children.size(), i);
+		if (node->IsLeaf())
+			return nullptr;
+
+		node = node->children[upper_bound(node->values.begin(), node->values.end(), value) - node->values.begin()];
 	}
-}
 
+	return nullptr;
+}
 
 /**
- * Gets the number of nodes in the tree.
+ * Collects the first value of every node below the regular minimum, the root excluded.
  * 
- * \return The number of nodes
+ * \param node The node to start from
+ * \param values The list to append to
  */
-template <class T>
-int BTree<T>::GetNodeCount()
+template <class T, class Monoid>
+void BTree<T, Monoid>::InternalCollectUnderfull(Node* node, vector<T>& values)
 {
-	if (root == nullptr)
-		return 0;
+	if (node != this->root && node->values.size() < floor((order - 1) / 2))
+		values.push_back(node->values.front());
 
-	int count = 0;
+	for (auto child : node->children)
+		InternalCollectUnderfull(child, values);
+}
 
-	queue<Node*> q;
-	q.push(root);
+/**
+ * Rebalances a node which may be short of more than one value, like the root of a tree grafted into another one.
+ * 
+ * \param node The node to repair
+ */
+template <class T, class Monoid>
+void BTree<T, Monoid>::InternalRepair(Node* node)
+{
+	int minAllowed = GetMinAllowed();
 
-	while (!q.empty())
+	// a rebalance either borrows one value from a sibling or merges with it, which fixes the node at once
+	while (node != this->root && node->values.size() < minAllowed)
 	{
-		Node* current = q.front();
-		q.pop();
+		Node* leftSibling = node->GetLeftSibling();
+		Node* rightSibling = node->GetRightSibling();
 
-		count++;
+		if (leftSibling != nullptr)
+			Touch(leftSibling);
+		if (rightSibling != nullptr)
+			Touch(rightSibling);
 
-		for (auto child : current->children)
-			q.push(child);
-	}
+		bool canBorrow = (leftSibling != nullptr && leftSibling->values.size() > minAllowed)
+			|| (rightSibling != nullptr && rightSibling->values.size() > minAllowed);
 
-	return count;
+		InternalRebalance(node);
+
+		// after a merge the node may not exist anymore
+		if (!canBorrow)
+			return;
+	}
 }
 
 /**
- * Gets the number of values in the tree.
+ * Joins two subtrees and a pivot between them into one tree, which is stored as the root of this tree.
+ * The lower tree is grafted onto the edge of the higher one at the level where their heights match,
+ * so only the nodes along that edge are touched.
  * 
- * \return The number of values
+ * \param left The root of the subtree with values lower than the pivot, can be nullptr
+ * \param leftHeight The height of the left subtree
+ * \param pivot The value between the two subtrees
+ * \param right The root of the subtree with values higher than the pivot, can be nullptr
+ * \param rightHeight The height of the right subtree
  */
-template <class T>
-int BTree<T>::GetValueCount()
+template <class T, class Monoid>
+void BTree<T, Monoid>::InternalJoin(Node* left, int leftHeight, T pivot, Node* right, int rightHeight)
 {
-	if (root == nullptr)
-		return 0;
+	// if one side is empty, the pivot just goes into the other one
+	if (left == nullptr || right == nullptr)
+	{
+		this->root = left != nullptr ? left : right;
+		this->height = left != nullptr ? leftHeight : rightHeight;
 
-	int count = 0;
+		InternalInsert(this->root, pivot);
+		return;
+	}
 
-	queue<Node*> q;
-	q.push(root);
+	left->parent = nullptr;
+	right->parent = nullptr;
 
-	while (!q.empty())
+	if (leftHeight == rightHeight)
 	{
-		Node* current = q.front();
-		q.pop();
-		count += current->values.size();
+		// if both roots fit into a single node, they are merged
+		if (left->values.size() + right->values.size() + 1 <= order - 1)
+		{
+			left->values.push_back(pivot);
+			left->values.insert(left->values.end(), right->values.begin(), right->values.end());
+			left->children.insert(left->children.end(), right->children.begin(), right->children.end());
+			left->Adopt();
 
-		for (auto child : current->children)
-			q.push(child);
+			right->children.clear();
+			delete right;
+
+			RefreshSummary(left);
+			this->root = left;
+			this->height = leftHeight;
+			return;
+		}
+
+		// otherwise the pivot becomes a new root above them - the tree is now 1 level higher
+		Node* newRoot = new Node(pivot, nullptr);
+		newRoot->children.push_back(left);
+		newRoot->children.push_back(right);
+		newRoot->Adopt();
+		RefreshSummary(newRoot);
+		BTREE_COUNT(allocations, 1);
+		BTREE_COUNT(rootGrows, 1);
+		Trace(TraceEventType::RootGrow, newRoot);
+
+		this->root = newRoot;
+		this->height = leftHeight + 1;
+
+		// the old roots may have too few values, but together they have enough for one to borrow from the other
+		InternalRepair(left);
+		InternalRepair(right);
 	}
+	else if (leftHeight > rightHeight)
+	{
+		// go down the right edge of the left tree to the node whose children are as high as the right tree
+		Node* node = left;
+		for (int i = leftHeight; i > rightHeight + 1; i--)
+			node = node->children.back();
 
-	return count;
+		node->values.push_back(pivot);
+		node->children.push_back(right);
+		node->Adopt();
+
+		this->root = left;
+		this->height = leftHeight;
+
+		// the node may overflow and the grafted root may have too few values
+		InternalSplit(node);
+		InternalRepair(right);
+	}
+	else
+	{
+		// go down the left edge of the right tree to the node whose children are as high as the left tree
+		Node* node = right;
+		for (int i = rightHeight; i > leftHeight + 1; i--)
+			node = node->children.front();
+
+		node->values.insert(node->values.begin(), pivot);
+		node->children.insert(node->children.begin(), left);
+		node->Adopt();
+
+		this->root = right;
+		this->height = rightHeight;
+
+		// the node may overflow and the grafted root may have too few values
+		InternalSplit(node);
+		InternalRepair(left);
+	}
 }
 
 /**
- * Gets the procentual fullness of the tree.
+ * Joins two subtrees without a pivot between them into one tree, which is stored as the root of this tree.
+ * The lowest value of the right subtree is taken out and used as the pivot.
  * 
- * \return The procentual fullness
+ * \param left The root of the subtree with lower values, can be nullptr
+ * \param leftHeight The height of the left subtree
+ * \param right The root of the subtree with higher values, can be nullptr
+ * \param rightHeight The height of the right subtree
  */
-template <class T>
-double BTree<T>::GetFullness()
+template <class T, class Monoid>
+void BTree<T, Monoid>::InternalConcat(Node* left, int leftHeight, Node* right, int rightHeight)
 {
-	if (root == nullptr)
-		return 0;
+	if (left == nullptr || right == nullptr)
+	{
+		this->root = left != nullptr ? left : right;
+		this->height = left != nullptr ? leftHeight : rightHeight;
 
-	int potentialCount = GetNodeCount() * (order - 1);
-	int actualCount = GetValueCount();
+		if (this->root != nullptr)
+			this->root->parent = nullptr;
+		return;
+	}
 
-	return ((double)actualCount / (double)potentialCount) * 100;
+	right->parent = nullptr;
+	this->root = right;
+	this->height = rightHeight;
+
+	T pivot = right->GetMostLeftChild()->values.front();
+	InternalRemove(this->root, pivot);
+
+	InternalJoin(left, leftHeight, pivot, this->root, this->height);
 }
 
 /**
- * Gets the height of the tree.
+ * Splits a subtree into the values lower and higher than a key. The subtree is taken apart
+ * along the path to the key and the pieces on each side are joined back together.
  * 
- * \return The height of the tree
+ * \param node The root of the subtree to split
+ * \param nodeHeight The height of the subtree
+ * \param key The key to split at
+ * \param left Receives the root of the lower part, nullptr if it is empty
+ * \param leftHeight Receives the height of the lower part
+ * \param found Receives whether the key was in the subtree, it is in neither part
+ * \param removed Receives the stored value equal to the key if it was found, with its count or payloads
+ * \param right Receives the root of the higher part, nullptr if it is empty
+ * \param rightHeight Receives the height of the higher part
  */
-template <class T>
-int BTree<T>::GetHeight()
+template <class T, class Monoid>
+void BTree<T, Monoid>::InternalSplitAt(Node* node, int nodeHeight, const T& key, Node*& left, int& leftHeight, bool& found, T& removed, Node*& right, int& rightHeight)
 {
-	if (root == nullptr)
-		return 0;
+	vector<T>& values = node->values;
+	vector<Node*>& children = node->children;
+	int size = values.size();
+
+	// the first value which isn't lower than the key
+	int i = lower_bound(values.begin(), values.end(), key) - values.begin();
+	found = i < size && !(key < values[i]);
+	if (found)
+		removed = values[i];
+
+	node->parent = nullptr;
+
+	if (node->IsLeaf())
+	{
+		// a new leaf takes the higher values, the key itself is dropped
+		right = nullptr;
+		rightHeight = 0;
+		if (i + (found ? 1 : 0) < size)
+		{
+			right = new Node();
+			BTREE_COUNT(allocations, 1);
+			right->values.assign(values.begin() + i + (found ? 1 : 0), values.end());
+			RefreshSummary(right);
+			rightHeight = 1;
+		}
+
+		// the old leaf keeps the lower values
+		values.erase(values.begin() + i, values.end());
+		RefreshSummary(node);
+		left = node;
+		leftHeight = 1;
+		if (values.empty())
+		{
+			delete node;
+			left = nullptr;
+			leftHeight = 0;
+		}
+		return;
+	}
+
+	// the child between values[i - 1] and values[i] is where the key belongs
+	Node* middleLeft = children[i];
+	int middleLeftHeight = nodeHeight - 1;
+	Node* middleRight = nullptr;
+	int middleRightHeight = 0;
+
+	middleLeft->parent = nullptr;
+
+	// if the key is in this node, the child lies entirely below it, otherwise the child has to be split too
+	bool foundHere = found;
+	if (!foundHere)
+		InternalSplitAt(children[i], nodeHeight - 1, key, middleLeft, middleLeftHeight, found, removed, middleRight, middleRightHeight);
+
+	// the higher piece of this node - values after values[i] with their children
+	Node* rightPiece = nullptr;
+	int rightPieceHeight = 0;
+	if (i + 1 < size)
+	{
+		rightPiece = new Node();
+		BTREE_COUNT(allocations, 1);
+		rightPiece->values.assign(values.begin() + i + 1, values.end());
+		rightPiece->children.assign(children.begin() + i + 1, children.end());
+		rightPiece->Adopt();
+		RefreshSummary(rightPiece);
+		rightPieceHeight = nodeHeight;
+	}
+	else if (i + 1 == size)
+	{
+		// without values the piece is just the last child
+		rightPiece = children[size];
+		rightPiece->parent = nullptr;
+		rightPieceHeight = nodeHeight - 1;
+	}
+
+	// the key itself is dropped
+	bool hasRightPivot = i < size && !foundHere;
+	T rightPivot = i < size ? values[i] : key;
+
+	// the lower piece of this node - values before values[i - 1] with their children, kept in the node itself
+	Node* leftPiece = nullptr;
+	int leftPieceHeight = 0;
+	bool hasLeftPivot = i > 0;
+	T leftPivot = i > 0 ? values[i - 1] : key;
+	if (i > 1)
+	{
+		values.erase(values.begin() + i - 1, values.end());
+		children.erase(children.begin() + i, children.end());
+		RefreshSummary(node);
+		leftPiece = node;
+		leftPieceHeight = nodeHeight;
+	}
+	else
+	{
+		// without values the piece is just the first child
+		if (i == 1)
+		{
+			leftPiece = children[0];
+			leftPiece->parent = nullptr;
+			leftPieceHeight = nodeHeight - 1;
+		}
 
-	int height = 1;
-	Node* current = root;
+		children.clear();
+		delete node;
+	}
 
-	while (!current->IsLeaf())
+	// lower part = lower piece + its pivot + lower part of the child
+	if (hasLeftPivot)
+	{
+		InternalJoin(leftPiece, leftPieceHeight, leftPivot, middleLeft, middleLeftHeight);
+		left = this->root;
+		leftHeight = this->height;
+	}
+	else
 	{
-		height++;
-		current = current->children[0];
+		left = middleLeft;
+		leftHeight = middleLeftHeight;
 	}
 
-	return height;
+	// higher part = higher part of the child + its pivot + higher piece
+	if (hasRightPivot)
+	{
+		InternalJoin(middleRight, middleRightHeight, rightPivot, rightPiece, rightPieceHeight);
+		right = this->root;
+		rightHeight = this->height;
+	}
+	else
+	{
+		InternalConcat(middleRight, middleRightHeight, rightPiece, rightPieceHeight);
+		right = this->root;
+		rightHeight = this->height;
+	}
 }
 
 /**
- * Prints some basic information about the tree.
+ * Splits a subtree into pieces by the values of the root of another subtree.
  * 
+ * \param a The root whose values are used to split
+ * \param b The root of the subtree to split
+ * \param bHeight The height of the subtree to split
+ * \param pieces Receives one piece for each gap between the values of a
+ * \param pieceHeights Receives the heights of the pieces
+ * \param found Receives whether each value of a was in the split subtree
+ * \param removed Receives the stored value of the split subtree matching each found value of a
  */
-template <class T>
-void BTree<T>::PrintInfo()
+template <class T, class Monoid>
+void BTree<T, Monoid>::InternalSplitByRoot(Node* a, Node* b, int bHeight, vector<Node*>& pieces, vector<int>& pieceHeights, vector<bool>& found, vector<T>& removed)
 {
-	cout << endl;
-	cout << "This tree is of order " << order << endl;
-	cout << "  max number of values in a node: " << order - 1 << endl;
-	cout << "  max number of children: " << order << endl;
-	cout << "  min number of values (except root): " << floor((order- 1)/2) << endl;
-	cout << "  min number of children (except root and leaves): " << floor((order - 1) / 2) + 1 << endl;
+	Node* rest = b;
+	int restHeight = bHeight;
 
-	cout << endl;
+	for (auto value : a->values)
+	{
+		Node* piece = nullptr;
+		int pieceHeight = 0;
+		bool foundValue = false;
+		T removedValue = value;
+
+		if (rest != nullptr)
+			InternalSplitAt(rest, restHeight, value, piece, pieceHeight, foundValue, removedValue, rest, restHeight);
+
+		pieces.push_back(piece);
+		pieceHeights.push_back(pieceHeight);
+		found.push_back(foundValue);
+		removed.push_back(removedValue);
+	}
+
+	pieces.push_back(rest);
+	pieceHeights.push_back(restHeight);
 }
 
 /**
- * Prints some statistics of the tree regarding its contents.
+ * Unites two subtrees into one tree, which is stored as the root of this tree. The second subtree is split
+ * by the values of the first root and each piece is united with the matching child, so the parts
+ * where the subtrees don't overlap are reused as they are. Values in both subtrees are merged by the multiset
+ * traits, so their counts add up.
  * 
+ * \param a The root of the first subtree, can be nullptr
+ * \param aHeight The height of the first subtree
+ * \param b The root of the second subtree, can be nullptr
+ * \param bHeight The height of the second subtree
  */
-template <class T>
-void BTree<T>::PrintStats()
+template <class T, class Monoid>
+void BTree<T, Monoid>::InternalUnion(Node* a, int aHeight, Node* b, int bHeight)
 {
-	cout << "Tree stats:" << endl;
+	if (a == nullptr || b == nullptr)
+	{
+		this->root = a != nullptr ? a : b;
+		this->height = a != nullptr ? aHeight : bHeight;
 
-	cout << "  Order: " << order << endl;
-	cout << "  Height: " << GetHeight() << endl;
-	cout << "  Number of nodes: " << GetNodeCount() << endl;
-	cout << "  Number of values: " << GetValueCount() << endl;
-	cout << "  Fullness: " << GetFullness() << "%" << endl;
+		if (this->root == nullptr)
+			this->height = 0;
+		else
+			this->root->parent = nullptr;
+		return;
+	}
+
+	vector<Node*> pieces;
+	vector<int> pieceHeights;
+	vector<bool> found;
+	vector<T> removed;
+	InternalSplitByRoot(a, b, bHeight, pieces, pieceHeights, found, removed);
+
+	vector<T> values = move(a->values);
+	vector<Node*> children = move(a->children);
+	a->children.clear();
+	delete a;
+
+	Node* result = nullptr;
+	int resultHeight = 0;
+
+	for (int i = 0; i <= values.size(); i++)
+	{
+		InternalUnion(children.empty() ? nullptr : children[i], aHeight - 1, pieces[i], pieceHeights[i]);
+
+		if (i == 0)
+		{
+			result = this->root;
+			resultHeight = this->height;
+		}
+		else
+		{
+			if (found[i - 1])
+				MultisetTraits<T>::Add(values[i - 1], removed[i - 1]);
+
+			InternalJoin(result, resultHeight, values[i - 1], this->root, this->height);
+			result = this->root;
+			resultHeight = this->height;
+		}
+	}
+
+	this->root = result;
+	this->height = resultHeight;
 }
 
 /**
- * Prints the tree.
+ * Intersects two subtrees into one tree, which is stored as the root of this tree. Works like the union,
+ * but only the values of the first root which are also in the second subtree are kept, with the lower
+ * of the two counts.
  * 
+ * \param a The root of the first subtree, can be nullptr
+ * \param aHeight The height of the first subtree
+ * \param b The root of the second subtree, can be nullptr
+ * \param bHeight The height of the second subtree
  */
-template <class T>
-void BTree<T>::Print()
+template <class T, class Monoid>
+void BTree<T, Monoid>::InternalIntersect(Node* a, int aHeight, Node* b, int bHeight)
 {
-	this->InternalPrint(this->root, " ", true, 0, 0);
+	if (a == nullptr || b == nullptr)
+	{
+		delete a;
+		delete b;
+
+		this->root = nullptr;
+		this->height = 0;
+		return;
+	}
+
+	vector<Node*> pieces;
+	vector<int> pieceHeights;
+	vector<bool> found;
+	vector<T> removed;
+	InternalSplitByRoot(a, b, bHeight, pieces, pieceHeights, found, removed);
+
+	vector<T> values = move(a->values);
+	vector<Node*> children = move(a->children);
+	a->children.clear();
+	delete a;
+
+	Node* result = nullptr;
+	int resultHeight = 0;
+
+	for (int i = 0; i <= values.size(); i++)
+	{
+		InternalIntersect(children.empty() ? nullptr : children[i], aHeight - 1, pieces[i], pieceHeights[i]);
+
+		if (i > 0)
+		{
+			if (found[i - 1] && MultisetTraits<T>::Intersect(values[i - 1], removed[i - 1]))
+				InternalJoin(result, resultHeight, values[i - 1], this->root, this->height);
+			else
+				InternalConcat(result, resultHeight, this->root, this->height);
+		}
+
+		result = this->root;
+		resultHeight = this->height;
+	}
+
+	this->root = result;
+	this->height = resultHeight;
 }
 
 /**
- * Inserts a value into the tree.
+ * Subtracts the second subtree from the first one, the result is stored as the root of this tree.
+ * Works like the union, but the values of the first root which are in the second subtree are left out,
+ * unless they are counted more times than in the second subtree, then only the count is reduced.
  * 
- * \param value The value to insert
+ * \param a The root of the subtree to subtract from, can be nullptr
+ * \param aHeight The height of the first subtree
+ * \param b The root of the subtree to subtract, can be nullptr
+ * \param bHeight The height of the second subtree
  */
-template <class T>
-void BTree<T>::Insert(T value)
+template <class T, class Monoid>
+void BTree<T, Monoid>::InternalDifference(Node* a, int aHeight, Node* b, int bHeight)
 {
-	this->InternalInsert(this->root, value);
+	if (a == nullptr || b == nullptr)
+	{
+		delete b;
+
+		this->root = a;
+		this->height = a != nullptr ? aHeight : 0;
+		if (a != nullptr)
+			a->parent = nullptr;
+		return;
+	}
+
+	vector<Node*> pieces;
+	vector<int> pieceHeights;
+	vector<bool> found;
+	vector<T> removed;
+	InternalSplitByRoot(a, b, bHeight, pieces, pieceHeights, found, removed);
+
+	vector<T> values = move(a->values);
+	vector<Node*> children = move(a->children);
+	a->children.clear();
+	delete a;
+
+	Node* result = nullptr;
+	int resultHeight = 0;
+
+	for (int i = 0; i <= values.size(); i++)
+	{
+		InternalDifference(children.empty() ? nullptr : children[i], aHeight - 1, pieces[i], pieceHeights[i]);
+
+		if (i > 0)
+		{
+			if (found[i - 1] && !MultisetTraits<T>::Subtract(values[i - 1], removed[i - 1]))
+				InternalConcat(result, resultHeight, this->root, this->height);
+			else
+				InternalJoin(result, resultHeight, values[i - 1], this->root, this->height);
+		}
+
+		result = this->root;
+		resultHeight = this->height;
+	}
+
+	this->root = result;
+	this->height = resultHeight;
+}
+
+/**
+ * Prints a node and all its children.
+ * 
+ * \param node The node to print
+ * \param indent The spaces and characters to indent the node with, shared by all levels and restored before returning
+ * \param last Whether the node is the last child of its parent
+ * \param siblings The number of siblings the node has
+ * \param position The position of the node in its parent
+ */
+template <class T, class Monoid>
+void BTree<T, Monoid>::InternalPrint(Node* node, string& indent, bool last, int siblings, int position)
+{
+	// \xB3 = |
+	// \xC3 = T
+	// \xC0 = L
+	// \xC4 = -
+
+	// if tree is empty
+	if (this->root == nullptr)
+	{
+		cout << "Tree is empty" << endl;
+		return;
+	}
+
+	// a cold subtree is printed from a decoded copy, the tree itself stays cold
+	if (node->cold != nullptr)
+	{
+		Node* copy = DecodeCopy(node);
+		InternalPrint(copy, indent, last, siblings, position);
+		delete copy;
+		return;
+	}
+
+	// last child needs a different symbol
+	size_t indentLength = indent.size();
+	cout << indent;
+	if (last)
+	{
+		if (siblings != 0)
+			cout << "\xC0\xC4";
+		indent.append("   ");
+	}
+	else
+	{
+		cout << "\xC3\xC4";
+		indent.append("\xB3  ");
+	}
+
+	// for the node
+	if (siblings == 0)
+	{
+		cout << CYAN << "Root: " << RESET;
+		node->PrintValues();
+	}
+	else
+	{
+		cout << CYAN << " " << position + 1 << ": " << RESET;
+		node->PrintValues();
+	}
+
+	// print all node children
+	for (int i = 0; i < node->children.size(); i++)
+	{
+		InternalPrint(node->children[i], indent, i == node->children.size() - 1, node->children.size(), i);
+	}
+
+	indent.resize(indentLength);
+}
+
+/**
+ * Writes the keys of a node, or an even sample of them if the node has more than allowed.
+ * 
+ * \param node The node
+ * \param out The buffer to write to
+ * \param options The export options
+ * \param json Whether to write a JSON array, otherwise the keys are separated by spaces
+ */
+template <class T, class Monoid>
+void BTree<T, Monoid>::ExportKeys(Node* node, ExportBuffer& out, const ExportOptions& options, bool json)
+{
+	int count = node->values.size();
+	int shown = options.maxKeysPerNode > 0 && options.maxKeysPerNode < count ? options.maxKeysPerNode : count;
+
+	int previous = -1;
+	for (int i = 0; i < shown; i++)
+	{
+		int index = shown == count ? i : (shown == 1 ? 0 : (long long)i * (count - 1) / (shown - 1));
+
+		if (i > 0)
+			out.Put(json ? ',' : ' ');
+		if (!json && index > previous + 1)
+			out.Put(".. ");
+		previous = index;
+
+		// numbers are written as they are, anything else as a string
+		if (json && !is_arithmetic<T>::value)
+		{
+			out.Put('"');
+			out.PutValue(node->values[index], ExportEscape::Json);
+			out.Put('"');
+		}
+		else
+		{
+			out.PutValue(node->values[index], options.format == ExportFormat::Dot ? ExportEscape::Dot : ExportEscape::None);
+		}
+	}
+}
+
+/**
+ * Writes a node and its children as lines of an outline.
+ * 
+ * \param node The node
+ * \param out The buffer to write to
+ * \param options The export options
+ * \param indent The prefix of the lines of the children, shared by all levels and restored before returning
+ * \param depth The level of the node, the root being level 0
+ * \param position The position of the node in its parent
+ */
+template <class T, class Monoid>
+void BTree<T, Monoid>::InternalExportOutline(Node* node, ExportBuffer& out, const ExportOptions& options, string& indent, int depth, int position)
+{
+	// a cold subtree is written from a decoded copy, the tree itself stays cold
+	if (node->cold != nullptr)
+	{
+		Node* copy = DecodeCopy(node);
+		InternalExportOutline(copy, out, options, indent, depth, position);
+		delete copy;
+		return;
+	}
+
+	if (depth == 0)
+	{
+		out.Put("Root: ( ");
+	}
+	else
+	{
+		out.Put(position + 1 == node->parent->children.size() ? "\\- " : "+- ");
+		out.Put((long long)position + 1);
+		out.Put(": ( ");
+	}
+
+	ExportKeys(node, out, options, false);
+	out.Put(" )");
+
+	if (!node->IsLeaf() && depth == options.maxDepth)
+	{
+		out.Put(" +");
+		out.Put((long long)node->children.size());
+		out.Put(" children not exported");
+	}
+	out.Put('\n');
+
+	if (depth == options.maxDepth)
+		return;
+
+	size_t indentLength = indent.size();
+	for (int i = 0; i < node->children.size(); i++)
+	{
+		// the lines below the last child have nothing to connect to on the left
+		bool last = i + 1 == node->children.size();
+
+		indent.resize(indentLength);
+		out.Put(indent.c_str());
+		indent.append(last ? "   " : "|  ");
+
+		InternalExportOutline(node->children[i], out, options, indent, depth + 1, i);
+	}
+
+	indent.resize(indentLength);
+}
+
+/**
+ * Writes a node and its children as Graphviz nodes and edges.
+ * 
+ * \param node The node
+ * \param out The buffer to write to
+ * \param options The export options
+ * \param depth The level of the node, the root being level 0
+ * \param nextId The id of the next written node
+ * \return The id of the node
+ */
+template <class T, class Monoid>
+long long BTree<T, Monoid>::InternalExportDot(Node* node, ExportBuffer& out, const ExportOptions& options, int depth, long long& nextId)
+{
+	if (node->cold != nullptr)
+	{
+		Node* copy = DecodeCopy(node);
+		long long id = InternalExportDot(copy, out, options, depth, nextId);
+		delete copy;
+		return id;
+	}
+
+	long long id = nextId++;
+
+	out.Put("\tn");
+	out.Put(id);
+	out.Put(" [label=\"");
+	ExportKeys(node, out, options, false);
+
+	if (!node->IsLeaf() && depth == options.maxDepth)
+	{
+		out.Put("\\n+");
+		out.Put((long long)node->children.size());
+		out.Put(" children");
+	}
+	out.Put("\"];\n");
+
+	if (depth == options.maxDepth)
+		return id;
+
+	for (auto child : node->children)
+	{
+		long long childId = InternalExportDot(child, out, options, depth + 1, nextId);
+
+		out.Put("\tn");
+		out.Put(id);
+		out.Put(" -> n");
+		out.Put(childId);
+		out.Put(";\n");
+	}
+
+	return id;
+}
+
+/**
+ * Writes a node and its children as a JSON object.
+ * 
+ * \param node The node
+ * \param out The buffer to write to
+ * \param options The export options
+ * \param depth The level of the node, the root being level 0
+ */
+template <class T, class Monoid>
+void BTree<T, Monoid>::InternalExportJson(Node* node, ExportBuffer& out, const ExportOptions& options, int depth)
+{
+	if (node->cold != nullptr)
+	{
+		Node* copy = DecodeCopy(node);
+		InternalExportJson(copy, out, options, depth);
+		delete copy;
+		return;
+	}
+
+	out.Put("{\"keys\":[");
+	ExportKeys(node, out, options, true);
+	out.Put(']');
+
+	// a sampled node tells how many keys it really has
+	if (options.maxKeysPerNode > 0 && options.maxKeysPerNode < node->values.size())
+	{
+		out.Put(",\"keyCount\":");
+		out.Put((long long)node->values.size());
+	}
+
+	if (!node->IsLeaf())
+	{
+		if (depth == options.maxDepth)
+		{
+			out.Put(",\"omittedChildren\":");
+			out.Put((long long)node->children.size());
+		}
+		else
+		{
+			out.Put(",\"children\":[");
+			for (int i = 0; i < node->children.size(); i++)
+			{
+				if (i > 0)
+					out.Put(',');
+				InternalExportJson(node->children[i], out, options, depth + 1);
+			}
+			out.Put(']');
+		}
+	}
+
+	out.Put('}');
+}
+
+
+/**
+ * Recomputes the summary of a node from its values and the summaries of its children.
+ * 
+ * \param node The node to refresh
+ */
+template <class T, class Monoid>
+void BTree<T, Monoid>::RefreshSummary(Node* node)
+{
+	// a cold subtree keeps the summary it had when it was made cold
+	if (!Monoid::enabled || node->cold != nullptr)
+		return;
+
+	typename Monoid::Value summary = Monoid::Identity();
+
+	for (int i = 0; i < node->values.size(); i++)
+	{
+		if (!node->IsLeaf())
+			summary = Monoid::Combine(summary, node->children[i]->summary);
+
+		summary = Monoid::Combine(summary, Monoid::Lift(node->values[i]));
+	}
+
+	if (!node->IsLeaf())
+		summary = Monoid::Combine(summary, node->children[node->values.size()]->summary);
+
+	node->summary = summary;
+}
+
+/**
+ * Recomputes the summaries of a node and all its ancestors.
+ * 
+ * \param node The lowest node to refresh
+ */
+template <class T, class Monoid>
+void BTree<T, Monoid>::RefreshPath(Node* node)
+{
+	if (!Monoid::enabled)
+		return;
+
+	for (; node != nullptr; node = node->parent)
+		RefreshSummary(node);
+}
+
+/**
+ * Combines the summaries of the values of a node and its children within a range. Children which lie
+ * entirely within the range contribute their stored summary, so only the two boundary paths are visited.
+ * 
+ * \param node The node to summarize
+ * \param lo The lowest value of the range
+ * \param hi The highest value of the range
+ * \param aboveLo Whether all values of the node are known to be at least lo
+ * \param belowHi Whether all values of the node are known to be at most hi
+ * \return The summary of the values within the range
+ */
+template <class T, class Monoid>
+typename Monoid::Value BTree<T, Monoid>::InternalAggregate(Node* node, const T& lo, const T& hi, bool aboveLo, bool belowHi)
+{
+	// a cold subtree keeps its summary, so it is only thawed if the range ends within it
+	if (aboveLo && belowHi)
+		return node->summary;
+
+	Touch(node);
+
+	typename Monoid::Value summary = Monoid::Identity();
+
+	for (int i = 0; i <= node->values.size(); i++)
+	{
+		// child i holds the values between values[i - 1] and values[i]
+		if (!node->IsLeaf() && (i == 0 || node->values[i - 1] < hi) && (i == node->values.size() || lo < node->values[i]))
+		{
+			bool childAboveLo = aboveLo || (i > 0 && !(node->values[i - 1] < lo));
+			bool childBelowHi = belowHi || (i < node->values.size() && !(hi < node->values[i]));
+
+			summary = Monoid::Combine(summary, InternalAggregate(node->children[i], lo, hi, childAboveLo, childBelowHi));
+		}
+
+		if (i == node->values.size() || hi < node->values[i])
+			break;
+
+		if (!(node->values[i] < lo))
+			summary = Monoid::Combine(summary, Monoid::Lift(node->values[i]));
+	}
+
+	return summary;
+}
+
+/**
+ * Appends all values of a node and its children to a list in ascending order.
+ * 
+ * \param node The node to collect from
+ * \param values The list to append to
+ */
+template <class T, class Monoid>
+void BTree<T, Monoid>::InternalCollect(Node* node, vector<T>& values)
+{
+	Touch(node);
+
+	for (int i = 0; i < node->values.size(); i++)
+	{
+		if (!node->IsLeaf())
+			InternalCollect(node->children[i], values);
+
+		values.push_back(node->values[i]);
+	}
+
+	if (!node->IsLeaf())
+		InternalCollect(node->children[node->values.size()], values);
+}
+
+/**
+ * Gets the number of values in a node and its children.
+ * 
+ * \param node The node to count
+ * \return The number of values
+ */
+template <class T, class Monoid>
+int BTree<T, Monoid>::InternalValueCount(Node* node)
+{
+	if (node->cold != nullptr)
+		return node->cold->valueCount;
+
+	int count = node->values.size();
+
+	for (auto child : node->children)
+		count += InternalValueCount(child);
+
+	return count;
+}
+
+/**
+ * Gets the number of values in a node and its children, with every counted value or posting list
+ * counted as often as it was inserted.
+ * 
+ * \param node The node to count
+ * \return The number of values
+ */
+template <class T, class Monoid>
+long long BTree<T, Monoid>::InternalMultiplicity(Node* node)
+{
+	if (!MultisetTraits<T>::enabled)
+		return InternalValueCount(node);
+
+	// the subtree is thawed by the callers
+	long long count = 0;
+	for (auto& value : node->values)
+		count += MultisetTraits<T>::Multiplicity(value);
+
+	for (auto child : node->children)
+		count += InternalMultiplicity(child);
+
+	return count;
+}
+
+/**
+ * Gets the number of nodes outside of cold blocks, the nodes holding the cold blocks included.
+ * 
+ * \param node The node to count from
+ * \return The number of nodes
+ */
+template <class T, class Monoid>
+int BTree<T, Monoid>::InternalHotNodeCount(Node* node)
+{
+	int count = 1;
+
+	// a cold node has no children
+	for (auto child : node->children)
+		count += InternalHotNodeCount(child);
+
+	return count;
+}
+
+/**
+ * Gets the number of values in a node and its children, but stops counting once there are more than a limit.
+ * 
+ * \param node The node to count
+ * \param limit The number of values to count up to
+ * \return The number of values, or some number above the limit
+ */
+template <class T, class Monoid>
+int BTree<T, Monoid>::InternalValueCountUpTo(Node* node, int limit)
+{
+	if (node->cold != nullptr)
+		return node->cold->valueCount;
+
+	int count = node->values.size();
+
+	for (int i = 0; i < node->children.size() && count <= limit; i++)
+		count += InternalValueCountUpTo(node->children[i], limit - count);
+
+	return count;
+}
+
+/**
+ * Calls a callback for every value of a node and its children within a range, in ascending order.
+ * 
+ * \param node The node to search
+ * \param lo The lowest value of the range
+ * \param hi The highest value of the range
+ * \param callback The callback to call for each value
+ */
+template <class T, class Monoid>
+void BTree<T, Monoid>::InternalForEachInRange(Node* node, const T& lo, const T& hi, const function<void(const T&)>& callback)
+{
+	Touch(node);
+
+	for (int i = 0; i <= node->values.size(); i++)
+	{
+		// child i holds the values between values[i - 1] and values[i], so it is skipped if that gap misses the range
+		if (!node->IsLeaf() && (i == 0 || node->values[i - 1] < hi) && (i == node->values.size() || lo < node->values[i]))
+			InternalForEachInRange(node->children[i], lo, hi, callback);
+
+		if (i == node->values.size())
+			return;
+
+		// everything further right is above the range
+		if (hi < node->values[i])
+			return;
+
+		if (!(node->values[i] < lo))
+			callback(node->values[i]);
+	}
+}
+
+/**
+ * Builds one level of the tree from sorted keys, filling the nodes as much as possible.
+ * The keys left between two neighbouring nodes are returned as separators for the level above.
+ * 
+ * \param keys The sorted keys of this level
+ * \param below The nodes of the level below (empty when building leaves), keys.size() + 1 of them
+ * \param separators Receives the separators between the built nodes
+ * \param pool The pool to build the nodes on
+ * \return The built nodes from left to right
+ */
+template <class T, class Monoid>
+vector<typename BTree<T, Monoid>::Node*> BTree<T, Monoid>::InternalBuildLevel(const vector<T>& keys, const vector<Node*>& below, vector<T>& separators, ThreadPool& pool)
+{
+	// every node takes at most order - 1 keys and one more key separates it from the next node
+	int nodeCount = (keys.size() + order) / order;
+
+	// the keys which aren't separators are spread evenly, so no node ends up under the minimum
+	int spread = keys.size() - (nodeCount - 1);
+	int base = spread / nodeCount;
+	int extra = spread % nodeCount;
+
+	vector<Node*> nodes(nodeCount);
+
+	// node j starts after j nodes and j separators, which is also the index of its first child
+	auto start = [&](int j) { return j * (base + 1) + min(j, extra); };
+	auto size = [&](int j) { return base + (j < extra ? 1 : 0); };
+
+	// the nodes don't depend on each other, so ranges of them are built in parallel
+	int chunkCount = min(nodeCount, pool.GetThreadCount() * 4);
+	pool.ParallelFor(chunkCount, [&](int chunk)
+	{
+		int first = (long long)nodeCount * chunk / chunkCount;
+		int last = (long long)nodeCount * (chunk + 1) / chunkCount;
+
+		for (int j = first; j < last; j++)
+		{
+			Node* node = new Node();
+			node->values.assign(keys.begin() + start(j), keys.begin() + start(j) + size(j));
+
+			if (!below.empty())
+			{
+				node->children.assign(below.begin() + start(j), below.begin() + start(j) + size(j) + 1);
+				node->Adopt();
+			}
+
+			RefreshSummary(node);
+			nodes[j] = node;
+		}
+	});
+
+	BTREE_COUNT(allocations, nodeCount);
+
+	separators.clear();
+	for (int j = 0; j < nodeCount - 1; j++)
+		separators.push_back(keys[start(j) + size(j)]);
+
+	return nodes;
+}
+
+/**
+ * Sorts a list by sorting chunks of it in parallel and merging them pairwise.
+ * 
+ * \param values The list to sort
+ * \param pool The pool to sort on
+ */
+template <class T, class Monoid>
+void BTree<T, Monoid>::ParallelSort(vector<T>& values, ThreadPool& pool)
+{
+	int chunkCount = pool.GetThreadCount();
+
+	// small lists are not worth splitting
+	if (chunkCount <= 1 || values.size() < 4096)
+	{
+		sort(values.begin(), values.end());
+		return;
+	}
+
+	// chunk i covers [bounds[i], bounds[i + 1])
+	vector<size_t> bounds;
+	for (int i = 0; i <= chunkCount; i++)
+		bounds.push_back(values.size() * i / chunkCount);
+
+	pool.ParallelFor(chunkCount, [&](int i)
+	{
+		sort(values.begin() + bounds[i], values.begin() + bounds[i + 1]);
+	});
+
+	// each round merges neighbouring sorted runs, doubling their width
+	for (int width = 1; width < chunkCount; width *= 2)
+	{
+		int pairCount = (chunkCount + 2 * width - 1) / (2 * width);
+
+		pool.ParallelFor(pairCount, [&](int p)
+		{
+			int first = p * 2 * width;
+			int middle = min(first + width, chunkCount);
+			int last = min(first + 2 * width, chunkCount);
+
+			inplace_merge(values.begin() + bounds[first], values.begin() + bounds[middle], values.begin() + bounds[last]);
+		});
+	}
+}
+
+
+/**
+ * Gets the number of nodes in the tree.
+ * 
+ * \return The number of nodes
+ */
+template <class T, class Monoid>
+int BTree<T, Monoid>::GetNodeCount()
+{
+	if (root == nullptr)
+		return 0;
+
+	int count = 0;
+
+	queue<Node*> q;
+	q.push(root);
+
+	while (!q.empty())
+	{
+		Node* current = q.front();
+		q.pop();
+
+		count += current->cold != nullptr ? current->cold->nodeCount : 1;
+
+		for (auto child : current->children)
+			q.push(child);
+	}
+
+	return count;
+}
+
+/**
+ * Gets the number of values in the tree.
+ * 
+ * \return The number of values
+ */
+template <class T, class Monoid>
+int BTree<T, Monoid>::GetValueCount()
+{
+	if (root == nullptr)
+		return flat.size();
+
+	int count = 0;
+
+	queue<Node*> q;
+	q.push(root);
+
+	while (!q.empty())
+	{
+		Node* current = q.front();
+		q.pop();
+		count += current->cold != nullptr ? current->cold->valueCount : current->values.size();
+
+		for (auto child : current->children)
+			q.push(child);
+	}
+
+	return count;
+}
+
+/**
+ * Gets the procentual fullness of the tree.
+ * 
+ * \return The procentual fullness
+ */
+template <class T, class Monoid>
+double BTree<T, Monoid>::GetFullness()
+{
+	if (root == nullptr)
+		return 0;
+
+	int potentialCount = GetNodeCount() * (order - 1);
+	int actualCount = GetValueCount();
+
+	return ((double)actualCount / (double)potentialCount) * 100;
+}
+
+/**
+ * Gets the height of the tree.
+ * 
+ * \return The height of the tree
+ */
+template <class T, class Monoid>
+int BTree<T, Monoid>::GetHeight()
+{
+	return this->height;
+}
+
+/**
+ * Checks the structure of a subtree, cold subtrees are checked on a decoded copy.
+ * 
+ * \param node The root of the subtree
+ * \param depth The level of the node, 1 for the root
+ * \param lo The separator below the subtree, nullptr if there is none
+ * \param hi The separator above the subtree, nullptr if there is none
+ * \return False if anything is broken
+ */
+template <class T, class Monoid>
+bool BTree<T, Monoid>::InternalValidate(Node* node, int depth, const T* lo, const T* hi)
+{
+	if (node->cold != nullptr)
+	{
+		Node* copy = DecodeCopy(node);
+		bool valid = InternalValidate(copy, depth, lo, hi);
+		delete copy;
+
+		return valid;
+	}
+
+	int minValues = node == this->root ? 1 : GetMinAllowed();
+	if (node->values.size() < minValues || node->values.size() > order - 1)
+		return false;
+
+	for (int i = 1; i < node->values.size(); i++)
+	{
+		if (!(node->values[i - 1] < node->values[i]))
+			return false;
+	}
+
+	if ((lo != nullptr && !(*lo < node->values.front())) || (hi != nullptr && !(node->values.back() < *hi)))
+		return false;
+
+	// all leaves are on the lowest level
+	if (node->IsLeaf())
+		return depth == this->height;
+
+	if (node->children.size() != node->values.size() + 1)
+		return false;
+
+	for (int i = 0; i < node->children.size(); i++)
+	{
+		const T* childLo = i == 0 ? lo : &node->values[i - 1];
+		const T* childHi = i == node->values.size() ? hi : &node->values[i];
+
+		if (node->children[i]->parent != node || !InternalValidate(node->children[i], depth + 1, childLo, childHi))
+			return false;
+	}
+
+	return true;
+}
+
+/**
+ * Checks the structure of the tree: every node holds ascending values between the separators around it,
+ * at least the minimum (which relaxed deletion lowers to one) and at most order - 1 of them,
+ * every child points back at its parent and all leaves are on the same level.
+ * 
+ * \return False if anything is broken
+ */
+template <class T, class Monoid>
+bool BTree<T, Monoid>::Validate()
+{
+	if (this->isFlat)
+	{
+		for (int i = 1; i < this->flat.size(); i++)
+		{
+			if (!(this->flat[i - 1] < this->flat[i]))
+				return false;
+		}
+
+		return this->root == nullptr;
+	}
+
+	if (this->root == nullptr)
+		return this->height == 0;
+
+	return this->root->parent == nullptr && InternalValidate(this->root, 1, nullptr, nullptr);
+}
+
+/**
+ * Prints some basic information about the tree.
+ * 
+ */
+template <class T, class Monoid>
+void BTree<T, Monoid>::PrintInfo()
+{
+	cout << endl;
+	cout << "This tree is of order " << order << endl;
+	cout << "  max number of values in a node: " << order - 1 << endl;
+	cout << "  max number of children: " << order << endl;
+	cout << "  min number of values (except root): " << floor((order- 1)/2) << endl;
+	cout << "  min number of children (except root and leaves): " << floor((order - 1) / 2) + 1 << endl;
+
+	cout << endl;
+}
+
+/**
+ * Prints some statistics of the tree regarding its contents.
+ * 
+ */
+template <class T, class Monoid>
+void BTree<T, Monoid>::PrintStats()
+{
+	cout << "Tree stats:" << endl;
+
+	cout << "  Order: " << order << endl;
+	cout << "  Height: " << GetHeight() << endl;
+	cout << "  Number of nodes: " << GetNodeCount() << endl;
+	cout << "  Number of values: " << GetValueCount() << endl;
+	cout << "  Representation: " << (isFlat ? "flat array" : "nodes") << " (flat up to " << flatCapacity << " values)" << endl;
+	cout << "  Fullness: " << GetFullness() << "%" << endl;
+	cout << "  Relaxed deletion: " << (relaxedDeletion ? "on" : "off") << endl;
+	cout << "  Structural changes per operation: " << GetStructuralChangesPerOperation() << endl;
+
+	TreeMemoryUsage memory = MemoryUsage();
+	cout << "  Memory (nodes / keys / children / slack): " << memory.nodeHeaders << " / " << memory.keyStorage << " / "
+		<< memory.childArrays << " / " << memory.slack << " B" << endl;
+	cout << "  Memory hot / cold: " << memory.Hot() << " / " << memory.coldBlocks << " B (" << coldCount << " cold subtrees, "
+		<< freezeCount << " made cold, " << thawCount << " thawed)" << endl;
+
+#ifdef BTREE_INSTRUMENTATION
+	cout << "Counters:" << endl;
+	cout << "  Operations: " << counters.operations << endl;
+	cout << "  Nodes visited: " << counters.nodesVisited << endl;
+	cout << "  Comparisons: " << counters.comparisons << endl;
+	cout << "  Splits: " << counters.splits << endl;
+	cout << "  Root grows / shrinks: " << counters.rootGrows << " / " << counters.rootShrinks << endl;
+	cout << "  Borrows left / right: " << counters.borrowsLeft << " / " << counters.borrowsRight << endl;
+	cout << "  Merges: " << counters.merges << endl;
+	cout << "  Allocations: " << counters.allocations << endl;
+#endif
+
+	if (latencyRecorder != nullptr)
+	{
+		const char* names[] = { "Insert", "Find", "Remove" };
+
+		cout << "Latencies (ns, p50 / p99 / p99.9 / max):" << endl;
+		for (int i = 0; i < recordedOperationTypes; i++)
+		{
+			LatencyHistogram histogram = latencyRecorder->GetHistogram((OperationType)i);
+			cout << "  " << names[i] << ": " << histogram.GetPercentile(50) << " / " << histogram.GetPercentile(99) << " / "
+				<< histogram.GetPercentile(99.9) << " / " << histogram.GetMax() << " (" << histogram.GetCount() << " samples)" << endl;
+		}
+	}
+}
+
+/**
+ * Prints the tree.
+ * 
+ */
+template <class T, class Monoid>
+void BTree<T, Monoid>::Print()
+{
+	string indent = " ";
+
+	if (this->isFlat && !this->flat.empty())
+	{
+		cout << indent << CYAN << "Flat: " << RESET;
+		cout << "( ";
+		for (auto& value : this->flat)
+			cout << value << " ";
+		cout << ")" << endl;
+		return;
+	}
+
+	this->InternalPrint(this->root, indent, true, 0, 0);
+	cout << flush;
+}
+
+/**
+ * Writes the tree into a stream as a text outline, Graphviz DOT or JSON. The output is collected
+ * in a buffer and written in large blocks, the stream is flushed only once at the end.
+ * 
+ * \param stream The stream to write to
+ * \param options The format, depth limit, key sampling and buffer size
+ */
+template <class T, class Monoid>
+void BTree<T, Monoid>::Export(ostream& stream, const ExportOptions& options)
+{
+	ExportBuffer out(stream, options.bufferSize);
+
+	// the flat array is shown as a single root node
+	Node flatRoot;
+	Node* shown = this->root;
+	int shownHeight = this->height;
+	if (this->isFlat && !this->flat.empty())
+	{
+		flatRoot.values = this->flat;
+		shown = &flatRoot;
+		shownHeight = 1;
+	}
+
+	switch (options.format)
+	{
+	case ExportFormat::Outline:
+	{
+		if (shown == nullptr)
+		{
+			out.Put("Tree is empty\n");
+			break;
+		}
+
+		string indent;
+		InternalExportOutline(shown, out, options, indent, 0, 0);
+		break;
+	}
+	case ExportFormat::Dot:
+	{
+		out.Put("digraph BTree {\n\tnode [shape=box];\n");
+
+		long long nextId = 0;
+		if (shown != nullptr)
+			InternalExportDot(shown, out, options, 0, nextId);
+
+		out.Put("}\n");
+		break;
+	}
+	case ExportFormat::Json:
+	{
+		out.Put("{\"order\":");
+		out.Put((long long)this->order);
+		out.Put(",\"height\":");
+		out.Put((long long)shownHeight);
+		out.Put(",\"root\":");
+
+		if (shown == nullptr)
+			out.Put("null");
+		else
+			InternalExportJson(shown, out, options, 0);
+
+		out.Put("}\n");
+		break;
+	}
+	}
+
+	out.Flush();
+	stream.flush();
+}
+
+/**
+ * Writes the tree into a file as a text outline, Graphviz DOT or JSON.
+ * 
+ * \param path The path of the file, it is overwritten
+ * \param options The format, depth limit, key sampling and buffer size
+ * \return False if the file couldn't be written
+ */
+template <class T, class Monoid>
+bool BTree<T, Monoid>::ExportToFile(const string& path, const ExportOptions& options)
+{
+	ofstream file(path, ios::binary);
+	if (!file)
+	{
+		cout << "can't open " << path << " for writing" << endl;
+		return false;
+	}
+
+	Export(file, options);
+	return file.good();
+}
+
+/**
+ * Writes the values into a page file, which a PagedTree reads back with asynchronous reads.
+ * 
+ * \param path The path of the file, it is overwritten
+ * \param pageSize The size of every page
+ * \return False if the file couldn't be written or the values aren't trivially copyable
+ */
+template <class T, class Monoid>
+bool BTree<T, Monoid>::WritePages(const string& path, int pageSize)
+{
+	vector<T> values = this->flat;
+	if (this->root != nullptr)
+		InternalCollect(this->root, values);
+
+	return WritePageFile(path, values, pageSize);
+}
+
+/**
+ * Moves the values of the flat array into nodes, once the tree grew past the flat capacity.
+ */
+template <class T, class Monoid>
+void BTree<T, Monoid>::Promote()
+{
+	if (!this->isFlat)
+		return;
+
+	vector<T> values;
+	values.swap(this->flat);
+	this->isFlat = false;
+
+	for (auto& value : values)
+		this->InternalInsert(this->root, value);
+}
+
+/**
+ * Moves the values back into the flat array if demotion is on and the tree shrunk to half of the flat capacity.
+ */
+template <class T, class Monoid>
+void BTree<T, Monoid>::DemoteIfSmall()
+{
+	if (this->isFlat || !this->flatDemotion || this->flatCapacity <= 0)
+		return;
+
+	int limit = this->flatCapacity / 2;
+
+	if (this->root != nullptr)
+	{
+		// every child holds at least one value, so most trees are ruled out without visiting the children
+		if ((int)(this->root->values.size() + this->root->children.size()) > limit || InternalValueCountUpTo(this->root, limit) > limit)
+			return;
+
+		InternalCollect(this->root, this->flat);
+		delete this->root;
+		this->root = nullptr;
+		this->height = 0;
+	}
+
+	this->isFlat = true;
+	this->compactPending.clear();
+	this->defragmenting = false;
+}
+
+/**
+ * Creates an empty tree with the order, the flat settings, the deletion mode and the tiering settings of this one,
+ * kept in nodes so its root can be assigned directly. It continues the access clock, which the nodes moved into it remember.
+ * 
+ * \return The new tree
+ */
+template <class T, class Monoid>
+BTree<T, Monoid>* BTree<T, Monoid>::MakeNodeTree()
+{
+	BTree<T, Monoid>* tree = new BTree<T, Monoid>(this->order);
+	tree->flatCapacity = this->flatCapacity;
+	tree->flatDemotion = this->flatDemotion;
+	tree->relaxedDeletion = this->relaxedDeletion;
+	tree->hotBudget = this->hotBudget;
+	tree->tierInterval = this->tierInterval;
+	tree->accessClock = this->accessClock;
+	tree->isFlat = false;
+
+	return tree;
+}
+
+/**
+ * Settles the deletion mode of a tree combined from two trees, which was built with relaxed deletion
+ * if either of them used it. It takes the mode of the first tree, and if that is the regular one,
+ * the nodes the other tree left below the regular minimum are compacted.
+ * 
+ * \param relaxed Whether the first tree uses relaxed deletion
+ */
+template <class T, class Monoid>
+void BTree<T, Monoid>::SettleDeletionMode(bool relaxed)
+{
+	if (!this->relaxedDeletion || relaxed)
+		return;
+
+	this->relaxedDeletion = false;
+	this->Compact();
+}
+
+/**
+ * Calls a callback for every value of the flat array within a range, in ascending order.
+ * 
+ * \param lo The lowest value of the range
+ * \param hi The highest value of the range
+ * \param callback The callback to call for each value
+ */
+template <class T, class Monoid>
+void BTree<T, Monoid>::FlatForEachInRange(const T& lo, const T& hi, const function<void(const T&)>& callback)
+{
+	for (auto it = lower_bound(this->flat.begin(), this->flat.end(), lo); it != this->flat.end() && !(hi < *it); ++it)
+		callback(*it);
+}
+
+/**
+ * Inserts a value into the tree.
+ * 
+ * \param value The value to insert
+ */
+template <class T, class Monoid>
+void BTree<T, Monoid>::Insert(T value)
+{
+	if (!this->TryInsert(value))
+		cout << "This value is already present" << endl;
+}
+
+/**
+ * Inserts a value into the tree without reporting a duplicate on the console.
+ * 
+ * \param value The value to insert
+ * \return False if the value was already present, trees of counted values or posting lists add it to the stored one instead
+ */
+template <class T, class Monoid>
+bool BTree<T, Monoid>::TryInsert(T value)
+{
+	this->operationCount++;
+	BTREE_COUNT(operations, 1);
+
+	if (this->traceWriter != nullptr)
+		RecordTrace(this->traceWriter, TraceOperation::Insert, value);
+
+	Tick();
+	bool sampled = BeginOperation(OperationType::Insert);
+	bool inserted = true;
+
+	if (this->isFlat)
+	{
+		BTREE_COUNT(comparisons, (long long)log2(this->flat.size() + 1) + 1);
+
+		auto it = lower_bound(this->flat.begin(), this->flat.end(), value);
+		if (it != this->flat.end() && *it == value)
+		{
+			if (MultisetTraits<T>::enabled)
+				MultisetTraits<T>::Add(*it, value);
+			else
+				inserted = false;
+		}
+		else
+		{
+			this->flat.insert(it, value);
+
+			if (this->flat.size() > this->flatCapacity)
+				Promote();
+		}
+	}
+	else
+	{
+		inserted = this->InternalInsert(this->root, value);
+	}
+
+	EndOperation(sampled);
+
+	return inserted;
+}
+
+/**
+ * Checks whether a value is present within the tree.
+ * 
+ * \param value The value to check for
+ * \return True if the value is present, false otherwise
+ */
+template <class T, class Monoid>
+bool BTree<T, Monoid>::Find(T value)
+{
+	BTREE_COUNT(operations, 1);
+
+	if (this->traceWriter != nullptr)
+		RecordTrace(this->traceWriter, TraceOperation::Find, value);
+
+	Tick();
+	bool sampled = BeginOperation(OperationType::Find);
+	bool found;
+	if (this->isFlat)
+	{
+		BTREE_COUNT(comparisons, (long long)log2(this->flat.size() + 1) + 1);
+		found = binary_search(this->flat.begin(), this->flat.end(), value);
+	}
+	else
+	{
+		found = this->root != nullptr && this->InternalFind(this->root, value);
+	}
+	EndOperation(sampled);
+
+	return found;
+}
+
+/**
+ * Removes a value from the tree.
+ *
+ * \param value The value to remove
+ */
+template <class T, class Monoid>
+void BTree<T, Monoid>::Remove(T value)
+{
+	// an empty tree has nothing to report
+	if (!this->TryRemove(value) && (this->isFlat ? !this->flat.empty() : this->root != nullptr))
+		cout << "This value is not present" << endl;
+}
+
+/**
+ * Removes a value from the tree without reporting a missing value on the console.
+ *
+ * \param value The value to remove
+ * \return False if the value was not present
+ */
+template <class T, class Monoid>
+bool BTree<T, Monoid>::TryRemove(T value)
+{
+	this->operationCount++;
+	BTREE_COUNT(operations, 1);
+
+	if (this->traceWriter != nullptr)
+		RecordTrace(this->traceWriter, TraceOperation::Remove, value);
+
+	if (this->isFlat ? this->flat.empty() : this->root == nullptr)
+		return false;
+
+	Tick();
+	bool sampled = BeginOperation(OperationType::Remove);
+	bool removed = true;
+
+	if (this->isFlat)
+	{
+		BTREE_COUNT(comparisons, (long long)log2(this->flat.size() + 1) + 1);
+
+		auto it = lower_bound(this->flat.begin(), this->flat.end(), value);
+		if (it == this->flat.end() || !(*it == value))
+			removed = false;
+		// a counted value only goes away once nothing is left of it
+		else if (!MultisetTraits<T>::enabled || !MultisetTraits<T>::Subtract(*it, value))
+			this->flat.erase(it);
+	}
+	else
+	{
+		removed = this->InternalRemove(this->root, value);
+		DemoteIfSmall();
+	}
+
+	EndOperation(sampled);
+
+	return removed;
+}
+
+/**
+ * Inserts a value a number of times. Trees of counted values or posting lists keep it once with all its repeats,
+ * other trees keep it once.
+ * 
+ * \param value The value to insert
+ * \param count The number of times to insert it
+ */
+template <class T, class Monoid>
+void BTree<T, Monoid>::InsertN(T value, long long count)
+{
+	if (count <= 0)
+		return;
+
+	this->Insert(MultisetTraits<T>::Repeat(value, count));
+}
+
+/**
+ * Gets how many times a value is present in the tree, found in a single descent.
+ * 
+ * \param value The value to count
+ * \return The number of times it is present, 0 or 1 for trees without counted values
+ */
+template <class T, class Monoid>
+long long BTree<T, Monoid>::Count(T value)
+{
+	const T* stored = this->Lookup(value);
+
+	return stored == nullptr ? 0 : MultisetTraits<T>::Multiplicity(*stored);
+}
+
+/**
+ * Gets the stored value equal to a value, e.g. to read the count or the payloads of a key.
+ * 
+ * \param value The value to look up
+ * \return The stored value, nullptr if it isn't present. It is valid until the tree is modified
+ */
+template <class T, class Monoid>
+const T* BTree<T, Monoid>::Lookup(T value)
+{
+	if (this->isFlat)
+	{
+		auto it = lower_bound(this->flat.begin(), this->flat.end(), value);
+		return it != this->flat.end() && *it == value ? &*it : nullptr;
+	}
+
+	// the clock moves first, so the budget check can't make the found node cold
+	Tick();
+
+	Node* node = this->InternalFindNode(this->root, value);
+	if (node == nullptr)
+		return nullptr;
+
+	return &node->values[node->GetValueIndex(value)];
+}
+
+/**
+ * Loads many values into the tree at once. The values are sorted in parallel and the tree is built
+ * bottom-up level by level, with the nodes of each level built in parallel. Values already in the tree
+ * are kept and duplicates are dropped.
+ * 
+ * \param values The values to load
+ * \param pool The pool to build on, the shared pool if nullptr
+ */
+template <class T, class Monoid>
+void BTree<T, Monoid>::BulkLoad(vector<T> values, ThreadPool* pool)
+{
+	if (pool == nullptr)
+		pool = &ThreadPool::Default();
+
+	// the current contents are rebuilt together with the new values
+	if (this->isFlat)
+	{
+		values.insert(values.end(), this->flat.begin(), this->flat.end());
+		this->flat.clear();
+	}
+	else if (this->root != nullptr)
+	{
+		InternalCollect(this->root, values);
+		delete this->root;
+		this->root = nullptr;
+		this->height = 0;
+	}
+
+	if (values.empty())
+		return;
+
+	ParallelSort(values, *pool);
+
+	// duplicates are dropped, or counted into the first of them
+	size_t kept = 0;
+	for (size_t i = 1; i < values.size(); i++)
+	{
+		if (values[kept] == values[i])
+			MultisetTraits<T>::Add(values[kept], values[i]);
+		else
+			values[++kept] = move(values[i]);
+	}
+	values.resize(kept + 1);
+
+	// a flat tree stays flat while the values fit
+	if (this->isFlat && values.size() <= this->flatCapacity)
+	{
+		this->flat = move(values);
+		return;
+	}
+
+	this->flat = vector<T>();
+	this->isFlat = false;
+
+	// build the leaves, then keep building levels from the separators until a single root is left
+	vector<T> separators;
+	vector<Node*> level = InternalBuildLevel(values, vector<Node*>(), separators, *pool);
+
+	this->height = 1;
+
+	while (level.size() > 1)
+	{
+		vector<T> keys = move(separators);
+		level = InternalBuildLevel(keys, level, separators, *pool);
+		this->height++;
+	}
+
+	this->root = level[0];
+	this->hotCounted = false;
+}
+
+/**
+ * Calls a callback for every value within a range, in ascending order.
+ * 
+ * \param lo The lowest value of the range
+ * \param hi The highest value of the range
+ * \param callback The callback to call for each value
+ */
+template <class T, class Monoid>
+void BTree<T, Monoid>::ForEachRange(T lo, T hi, const function<void(const T&)>& callback)
+{
+	if (this->traceWriter != nullptr)
+		RecordTrace(this->traceWriter, TraceOperation::Scan, lo, hi);
+
+	if (hi < lo)
+		return;
+
+	Tick();
+
+	if (this->isFlat)
+		this->FlatForEachInRange(lo, hi, callback);
+	else if (this->root != nullptr)
+		this->InternalForEachInRange(this->root, lo, hi, callback);
+}
+
+/**
+ * Scans several ranges at once, each on its own worker. The ranges should be disjoint and the tree
+ * must not be modified during the scan. The callback is called concurrently from the workers.
+ * 
+ * \param ranges The lowest and highest value of each range
+ * \param callback The callback to call with the index of the range and each value within it
+ * \param pool The pool to scan on, the shared pool if nullptr
+ */
+template <class T, class Monoid>
+void BTree<T, Monoid>::ParallelForEachRange(const vector<pair<T, T>>& ranges, const function<void(int, const T&)>& callback, ThreadPool* pool)
+{
+	if (this->isFlat ? this->flat.empty() : this->root == nullptr)
+		return;
+
+	if (pool == nullptr)
+		pool = &ThreadPool::Default();
+
+	// the workers must not thaw nodes or move the clock, so the ranges are thawed and touched beforehand
+	if (!this->isFlat && (this->coldCount > 0 || this->hotBudget > 0))
+	{
+		for (auto& range : ranges)
+		{
+			if (!(range.second < range.first))
+				this->InternalForEachInRange(this->root, range.first, range.second, [](const T&) {});
+		}
+	}
+
+	pool->ParallelFor(ranges.size(), [&](int i)
+	{
+		if (ranges[i].second < ranges[i].first)
+			return;
+
+		if (this->isFlat)
+			this->FlatForEachInRange(ranges[i].first, ranges[i].second, [&](const T& value) { callback(i, value); });
+		else
+			this->InternalForEachInRange(this->root, ranges[i].first, ranges[i].second, [&](const T& value) { callback(i, value); });
+	});
+}
+
+/**
+ * Removes all values within a range. The tree is split at both ends of the range, the part in between
+ * is freed as a whole and the two outer parts are joined back together, so only the nodes along
+ * the two boundary paths are rebalanced.
+ * 
+ * \param lo The lowest value of the range
+ * \param hi The highest value of the range
+ * \return The number of removed values, counted values and posting lists count as often as they were inserted
+ */
+template <class T, class Monoid>
+long long BTree<T, Monoid>::RemoveRange(T lo, T hi)
+{
+	if (this->traceWriter != nullptr)
+		RecordTrace(this->traceWriter, TraceOperation::RemoveRange, lo, hi);
+
+	if (hi < lo)
+		return 0;
+
+	if (this->isFlat)
+	{
+		auto first = lower_bound(this->flat.begin(), this->flat.end(), lo);
+		auto last = upper_bound(first, this->flat.end(), hi);
+		long long removed = 0;
+		for (auto it = first; it != last; ++it)
+			removed += MultisetTraits<T>::Multiplicity(*it);
+		this->flat.erase(first, last);
+
+		return removed;
+	}
+
+	if (this->root == nullptr)
+		return 0;
+
+	ThawAll();
+
+	Node* below;
+	Node* rest;
+	int belowHeight, restHeight;
+	bool foundLo;
+	T removedLo = lo;
+	this->InternalSplitAt(this->root, this->height, lo, below, belowHeight, foundLo, removedLo, rest, restHeight);
+
+	Node* inside = nullptr;
+	Node* above = nullptr;
+	int insideHeight = 0, aboveHeight = 0;
+	bool foundHi = false;
+	T removedHi = hi;
+	if (rest != nullptr)
+		this->InternalSplitAt(rest, restHeight, hi, inside, insideHeight, foundHi, removedHi, above, aboveHeight);
+
+	// the bounds themselves were dropped by the splits
+	long long removed = (foundLo ? MultisetTraits<T>::Multiplicity(removedLo) : 0) + (foundHi ? MultisetTraits<T>::Multiplicity(removedHi) : 0);
+
+	if (inside != nullptr)
+	{
+		removed += InternalMultiplicity(inside);
+		delete inside;
+	}
+
+	this->InternalConcat(below, belowHeight, above, aboveHeight);
+	this->hotCounted = false;
+	DemoteIfSmall();
+
+	return removed;
+}
+
+/**
+ * Summarizes the values within a range with the monoid of the tree, for example their sum.
+ * Takes O(log n) stored summaries instead of visiting every value.
+ * 
+ * \param lo The lowest value of the range
+ * \param hi The highest value of the range
+ * \return The summary of the values within the range
+ */
+template <class T, class Monoid>
+typename Monoid::Value BTree<T, Monoid>::Aggregate(T lo, T hi)
+{
+	if (hi < lo)
+		return Monoid::Identity();
+
+	// the flat array keeps no summaries, it is small enough to fold
+	if (this->isFlat)
+	{
+		typename Monoid::Value summary = Monoid::Identity();
+		this->FlatForEachInRange(lo, hi, [&](const T& value) { summary = Monoid::Combine(summary, Monoid::Lift(value)); });
+
+		return summary;
+	}
+
+	if (this->root == nullptr)
+		return Monoid::Identity();
+
+	Tick();
+	return this->InternalAggregate(this->root, lo, hi, false, false);
+}
+
+/**
+ * Sets how many values the tree keeps in a single sorted array before it is promoted to nodes.
+ * Small trees then need no node objects and are searched by binary search. A smaller capacity promotes
+ * a flat tree holding more values right away, a larger one doesn't demote a tree already in nodes.
+ * 
+ * \param capacity The most values of the flat array, 0 to always use nodes
+ * \param demote Whether a tree shrunk to half of the capacity is demoted back to the flat array
+ */
+template <class T, class Monoid>
+void BTree<T, Monoid>::SetFlatCapacity(int capacity, bool demote)
+{
+	this->flatCapacity = capacity < 0 ? 0 : capacity;
+	this->flatDemotion = demote;
+
+	if (this->isFlat && this->flat.size() > this->flatCapacity)
+		Promote();
+}
+
+/**
+ * Checks whether the values are kept in the flat array instead of nodes.
+ * 
+ * \return True if the tree is flat
+ */
+template <class T, class Monoid>
+bool BTree<T, Monoid>::IsFlat()
+{
+	return this->isFlat;
+}
+
+/**
+ * Switches relaxed deletion on or off. With relaxed deletion a node is only rebalanced once it runs empty,
+ * which saves most of the borrows and merges of mixed insert and remove workloads at the cost of fullness.
+ * Compact restores the regular minimum, it should also be run after switching relaxed deletion off.
+ * 
+ * \param relaxed Whether to use relaxed deletion
+ */
+template <class T, class Monoid>
+void BTree<T, Monoid>::SetRelaxedDeletion(bool relaxed)
+{
+	this->relaxedDeletion = relaxed;
+}
+
+/**
+ * Rebalances the nodes left below the regular minimum by relaxed deletion. The work can be done
+ * in steps between other operations, the nodes still to be fixed are remembered by their first value.
+ * 
+ * \param maxSteps The maximal number of nodes to fix, -1 for no limit
+ * \return True if no node is below the minimum anymore, false if there is more work left
+ */
+template <class T, class Monoid>
+bool BTree<T, Monoid>::Compact(int maxSteps)
+{
+	if (this->root == nullptr)
+	{
+		this->compactPending.clear();
+		return true;
+	}
+
+	ThawAll();
+	this->compacting = true;
+
+	for (int steps = 0; maxSteps < 0 || steps < maxSteps; steps++)
+	{
+		// when the list runs out, the tree is scanned again for nodes which are still or newly under the minimum
+		if (this->compactPending.empty())
+		{
+			this->InternalCollectUnderfull(this->root, this->compactPending);
+
+			if (this->compactPending.empty())
+			{
+				this->compacting = false;
+				return true;
+			}
+		}
+
+		T value = this->compactPending.back();
+		this->compactPending.pop_back();
+
+		// the value may have moved to another node or been removed since it was collected
+		Node* node = this->InternalFindNode(this->root, value);
+		if (node != nullptr)
+			this->InternalRepair(node);
+	}
+
+	this->compacting = false;
+	return false;
+}
+
+/**
+ * Gets the heap memory held by a value besides the value itself.
+ * 
+ * \param value The value
+ * \return The number of bytes
+ */
+template <class V>
+static size_t HeapBytes(const V& value)
+{
+	return 0;
+}
+
+static size_t HeapBytes(const string& value)
+{
+	// short strings are kept within the string object itself
+	const char* data = value.data();
+	if (data >= (const char*)&value && data < (const char*)(&value + 1))
+		return 0;
+
+	return value.capacity() + 1;
+}
+
+template <class K>
+static size_t HeapBytes(const Counted<K>& value)
+{
+	return HeapBytes(value.key);
+}
+
+template <class K, class P>
+static size_t HeapBytes(const Posting<K, P>& value)
+{
+	return HeapBytes(value.key) + value.payloads.capacity() * sizeof(P);
+}
+
+/**
+ * Adds up the memory held by a node and its children.
+ * 
+ * \param node The node
+ * \param usage The usage to add to
+ * \param arenas The arenas the nodes live in, their unused slots are counted afterwards
+ */
+template <class T, class Monoid>
+void BTree<T, Monoid>::InternalMemoryUsage(Node* node, TreeMemoryUsage& usage, unordered_set<NodeArena*>& arenas)
+{
+	NodeArena* arena = NodeArena::GetArena(node);
+	if (arena == nullptr)
+	{
+		usage.nodeHeaders += NodeArena::prefixSize + sizeof(Node);
+	}
+	else
+	{
+		usage.nodeHeaders += arena->GetSlotSize();
+		arenas.insert(arena);
+	}
+
+	if (node->cold != nullptr)
+	{
+		usage.coldBlocks += sizeof(ColdBlock) + node->cold->bytes.capacity();
+		return;
+	}
+
+	usage.keyStorage += node->values.size() * sizeof(T);
+	for (auto& value : node->values)
+		usage.keyStorage += HeapBytes(value);
+
+	usage.childArrays += node->children.size() * sizeof(Node*);
+	usage.slack += (node->values.capacity() - node->values.size()) * sizeof(T);
+	usage.slack += (node->children.capacity() - node->children.size()) * sizeof(Node*);
+
+	for (auto child : node->children)
+		InternalMemoryUsage(child, usage, arenas);
+}
+
+/**
+ * Gets the memory held by the tree, split into the node objects, the values, the child pointers
+ * and the capacity reserved but not used.
+ * 
+ * \return The memory usage
+ */
+template <class T, class Monoid>
+TreeMemoryUsage BTree<T, Monoid>::MemoryUsage()
+{
+	TreeMemoryUsage usage;
+	unordered_set<NodeArena*> arenas;
+
+	if (this->root != nullptr)
+		InternalMemoryUsage(this->root, usage, arenas);
+
+	usage.keyStorage += this->flat.size() * sizeof(T);
+	for (auto& value : this->flat)
+		usage.keyStorage += HeapBytes(value);
+	usage.slack += (this->flat.capacity() - this->flat.size()) * sizeof(T);
+
+	// the slots of deleted nodes aren't reused until the whole arena is freed
+	for (auto arena : arenas)
+		usage.slack += (size_t)(arena->GetCapacity() - arena->GetLiveCount()) * arena->GetSlotSize();
+
+	return usage;
+}
+
+/**
+ * Marks a node as just accessed, thawing it first if it is cold. Every descent passes through here.
+ * 
+ * \param node The node
+ */
+template <class T, class Monoid>
+void BTree<T, Monoid>::Touch(Node* node)
+{
+	if (node->cold != nullptr)
+		Thaw(node);
+
+	// without a budget the clock isn't needed, and concurrent scans must not write into the nodes
+	if (this->hotBudget > 0 && node->lastAccess != this->accessClock)
+		node->lastAccess = this->accessClock;
+}
+
+/**
+ * Advances the access clock after an operation and checks the budget every few operations.
+ */
+template <class T, class Monoid>
+void BTree<T, Monoid>::Tick()
+{
+	if (this->hotBudget == 0)
+		return;
+
+	this->accessClock++;
+
+	if (this->accessClock % this->tierInterval == 0)
+		FreezeCold();
+}
+
+/**
+ * Compresses a subtree into a cold block. The node stays in place with its summary, so its parent
+ * and the aggregates don't notice, but its values and children are freed.
+ * 
+ * \param node The root of the subtree
+ */
+template <class T, class Monoid>
+void BTree<T, Monoid>::Freeze(Node* node)
+{
+	ColdBlock* block = new ColdBlock();
+
+	for (Node* leftmost = node; leftmost != nullptr; leftmost = leftmost->IsLeaf() ? nullptr : leftmost->children[0])
+		block->height++;
+
+	InternalEncodeShape(node, *block);
+
+	T previous = T();
+	InternalEncodeValues(node, *block, previous);
+	block->bytes.shrink_to_fit();
+
+	for (auto child : node->children)
+		delete child;
+	vector<Node*>().swap(node->children);
+	vector<T>().swap(node->values);
+
+	node->cold = block;
+	this->coldCount++;
+	this->freezeCount++;
+	this->hotNodes -= block->nodeCount - 1;
+}
+
+/**
+ * Decodes a cold subtree back into nodes, in place of the node holding it.
+ * 
+ * \param node The node holding the cold block
+ */
+template <class T, class Monoid>
+void BTree<T, Monoid>::Thaw(Node* node)
+{
+	ColdBlock* block = node->cold;
+	node->cold = nullptr;
+
+	InternalDecode(node, *block);
+
+	BTREE_COUNT(allocations, block->nodeCount - 1);
+	this->hotNodes += block->nodeCount - 1;
+	delete block;
+	this->coldCount--;
+	this->thawCount++;
+}
+
+/**
+ * Rebuilds the nodes and values of a cold block below a node without children.
+ * 
+ * \param node The node to rebuild the subtree from
+ * \param block The block
+ */
+template <class T, class Monoid>
+void BTree<T, Monoid>::InternalDecode(Node* node, const ColdBlock& block)
+{
+	const char* position = block.bytes.data();
+	InternalDecodeShape(node, block.height, position);
+
+	T previous = T();
+	InternalDecodeValues(node, position, previous);
+}
+
+/**
+ * Decodes a cold subtree into a detached copy, so it can be shown without thawing it.
+ * The copy points to the parent of the node, but the parent doesn't point to the copy.
+ * 
+ * \param node The node holding the cold block
+ * \return The root of the copy, to be deleted by the caller
+ */
+template <class T, class Monoid>
+typename BTree<T, Monoid>::Node* BTree<T, Monoid>::DecodeCopy(Node* node)
+{
+	Node* copy = new Node();
+	copy->parent = node->parent;
+	InternalDecode(copy, *node->cold);
+
+	return copy;
+}
+
+/**
+ * Thaws all cold subtrees below a node.
+ * 
+ * \param node The node
+ */
+template <class T, class Monoid>
+void BTree<T, Monoid>::InternalThawAll(Node* node)
+{
+	if (node->cold != nullptr)
+	{
+		// a thawed subtree holds no cold blocks
+		Thaw(node);
+		return;
+	}
+
+	for (auto child : node->children)
+		InternalThawAll(child);
+}
+
+/**
+ * Gets the leaf furthest to the left below a node, thawing the nodes on the way.
+ * 
+ * \param node The node
+ * \return The most left leaf
+ */
+template <class T, class Monoid>
+typename BTree<T, Monoid>::Node* BTree<T, Monoid>::ThawedMostLeft(Node* node)
+{
+	for (Touch(node); !node->IsLeaf(); Touch(node))
+		node = node->children.front();
+
+	return node;
+}
+
+/**
+ * Gets the leaf furthest to the right below a node, thawing the nodes on the way.
+ * 
+ * \param node The node
+ * \return The most right leaf
+ */
+template <class T, class Monoid>
+typename BTree<T, Monoid>::Node* BTree<T, Monoid>::ThawedMostRight(Node* node)
+{
+	for (Touch(node); !node->IsLeaf(); Touch(node))
+		node = node->children.back();
+
+	return node;
+}
+
+/**
+ * Appends the number of values of a node and its children to a block, in pre-order.
+ * 
+ * \param node The node
+ * \param block The block
+ */
+template <class T, class Monoid>
+void BTree<T, Monoid>::InternalEncodeShape(Node* node, ColdBlock& block)
+{
+	// only subtrees of one height are made cold, but a root shrink can bring a cold node up
+	if (node->cold != nullptr)
+		Thaw(node);
+
+	Varint::Put(block.bytes, node->values.size());
+	block.nodeCount++;
+	block.valueCount += node->values.size();
+
+	for (auto child : node->children)
+		InternalEncodeShape(child, block);
+}
+
+/**
+ * Appends the values of a node and its children to a block, in ascending order.
+ * 
+ * \param node The node
+ * \param block The block
+ * \param previous The last value appended
+ */
+template <class T, class Monoid>
+void BTree<T, Monoid>::InternalEncodeValues(Node* node, ColdBlock& block, T& previous)
+{
+	for (int i = 0; i < node->values.size(); i++)
+	{
+		if (!node->IsLeaf())
+			InternalEncodeValues(node->children[i], block, previous);
+
+		ColdCodec<T>::Encode(block.bytes, previous, node->values[i]);
+	}
+
+	if (!node->IsLeaf())
+		InternalEncodeValues(node->children.back(), block, previous);
+}
+
+/**
+ * Rebuilds the nodes of a subtree from the sizes stored by InternalEncodeShape, the values are filled in later.
+ * 
+ * \param node The node to rebuild
+ * \param nodeHeight The number of levels from the node down
+ * \param position The position in the block, moved past the sizes
+ */
+template <class T, class Monoid>
+void BTree<T, Monoid>::InternalDecodeShape(Node* node, int nodeHeight, const char*& position)
+{
+	node->values.resize(Varint::Get(position));
+	node->lastAccess = this->accessClock;
+
+	if (nodeHeight == 1)
+		return;
+
+	node->children.resize(node->values.size() + 1);
+	for (auto& child : node->children)
+	{
+		child = new Node();
+		child->parent = node;
+		InternalDecodeShape(child, nodeHeight - 1, position);
+	}
+}
+
+/**
+ * Fills the values of a rebuilt subtree from those stored by InternalEncodeValues and refreshes its summaries.
+ * 
+ * \param node The node
+ * \param position The position in the block, moved past the values
+ * \param previous The last value read
+ */
+template <class T, class Monoid>
+void BTree<T, Monoid>::InternalDecodeValues(Node* node, const char*& position, T& previous)
+{
+	for (int i = 0; i < node->values.size(); i++)
+	{
+		if (!node->IsLeaf())
+			InternalDecodeValues(node->children[i], position, previous);
+
+		ColdCodec<T>::Decode(position, previous, node->values[i]);
+	}
+
+	if (!node->IsLeaf())
+		InternalDecodeValues(node->children.back(), position, previous);
+
+	RefreshSummary(node);
+}
+
+/**
+ * Collects the nodes of a given height which aren't cold yet, the root excluded.
+ * 
+ * \param node The node to start from
+ * \param nodeHeight The number of levels from the node down
+ * \param candidateHeight The height of the nodes to collect
+ * \param candidates The list to append to
+ */
+template <class T, class Monoid>
+void BTree<T, Monoid>::InternalCollectColdCandidates(Node* node, int nodeHeight, int candidateHeight, vector<Node*>& candidates)
+{
+	if (node->cold != nullptr)
+		return;
+
+	if (nodeHeight == candidateHeight)
+	{
+		if (node != this->root)
+			candidates.push_back(node);
+		return;
+	}
+
+	for (auto child : node->children)
+		InternalCollectColdCandidates(child, nodeHeight - 1, candidateHeight, candidates);
 }
 
 /**
- * Checks whether a value is present within the tree.
+ * Sets the memory budget of the nodes. Every few operations the budget is checked, and while the nodes hold more,
+ * the least recently used subtrees are compressed into cold blocks. A descent reaching a cold subtree thaws it.
+ * Operations on whole trees (splits, joins, range removes, defragmentation and compaction) thaw all of it first,
+ * prints and exports decode the cold subtrees into temporary copies. The budget holds for each tree on its own,
+ * the trees made by splits, joins and set operations get the settings of the (first) tree they came from.
  * 
- * \param value The value to check for
- * \return True if the value is present, false otherwise
+ * \param hotBudget The most bytes the nodes may hold, 0 to stop making subtrees cold (the cold ones thaw as they are used)
+ * \param interval The number of operations between two checks of the budget
  */
-template <class T>
-bool BTree<T>::Find(T value)
+template <class T, class Monoid>
+void BTree<T, Monoid>::SetTiering(size_t hotBudget, int interval)
 {
-	return this->InternalFind(this->root, value);
+	this->hotBudget = hotBudget;
+	this->tierInterval = interval < 1 ? 1 : interval;
 }
 
 /**
- * Removes a value from the tree.
- *
- * \param value The value to remove
+ * Compresses the least recently used subtrees until the nodes fit the budget. The subtrees are cut at the height
+ * where each can hold 64 values or more, so the encoding has enough to work with while a thaw stays cheap.
+ * Subtrees used within the last interval of operations are kept. Only integers, strings and counted values can be compressed.
+ * 
+ * \return The number of subtrees made cold
+ */
+template <class T, class Monoid>
+int BTree<T, Monoid>::FreezeCold()
+{
+	if (!ColdCodec<T>::enabled || this->hotBudget == 0 || this->root == nullptr)
+		return 0;
+
+	// walking the nodes costs as much as the whole tree, so they are only measured once the estimate
+	// from the count of hot nodes reaches the budget, or after the count was lost
+	if (this->hotCounted && (size_t)this->hotNodes * this->hotNodeBytes <= this->hotBudget)
+		return 0;
+
+	size_t hot = MemoryUsage().Hot();
+	this->hotNodes = InternalHotNodeCount(this->root);
+	this->hotNodeBytes = hot / this->hotNodes;
+	this->hotCounted = true;
+
+	if (hot <= this->hotBudget)
+		return 0;
+
+	int candidateHeight = 1;
+	for (long long span = this->order; span < 64; span *= this->order)
+		candidateHeight++;
+
+	vector<Node*> candidates;
+	if (this->height > candidateHeight)
+		InternalCollectColdCandidates(this->root, this->height, candidateHeight, candidates);
+
+	stable_sort(candidates.begin(), candidates.end(), [](Node* a, Node* b) { return a->lastAccess < b->lastAccess; });
+
+	int frozen = 0;
+	for (auto node : candidates)
+	{
+		// the subtrees used since the last check stay hot even over the budget, or they would be thawed again right away
+		if (hot <= this->hotBudget || node->lastAccess + this->tierInterval > this->accessClock)
+			break;
+
+		TreeMemoryUsage before;
+		unordered_set<NodeArena*> arenas;
+		InternalMemoryUsage(node, before, arenas);
+
+		Freeze(node);
+		frozen++;
+
+		// the node itself stays
+		size_t kept = NodeArena::prefixSize + sizeof(Node);
+		size_t freed = before.Hot() > kept ? before.Hot() - kept : 0;
+		hot = hot > freed ? hot - freed : 0;
+	}
+
+	return frozen;
+}
+
+/**
+ * Thaws all cold subtrees.
+ */
+template <class T, class Monoid>
+void BTree<T, Monoid>::ThawAll()
+{
+	if (this->coldCount > 0 && this->root != nullptr)
+		InternalThawAll(this->root);
+}
+
+/**
+ * Moves a node into the current arena. Its values and children get buffers of exactly their size,
+ * allocated right after the ones of the previously moved node.
+ * 
+ * \param node The node to move
+ * \return The moved node, the original one is deleted
+ */
+template <class T, class Monoid>
+typename BTree<T, Monoid>::Node* BTree<T, Monoid>::RelocateNode(Node* node)
+{
+	if (this->defragmentArena == nullptr || this->defragmentArena->IsFull())
+	{
+		if (this->defragmentArena != nullptr)
+			this->defragmentArena->Seal();
+
+		this->defragmentArena = new NodeArena(sizeof(Node), this->defragmentArenaCapacity);
+	}
+
+	Node* moved = new (this->defragmentArena) Node();
+	BTREE_COUNT(allocations, 1);
+
+	moved->values.reserve(node->values.size());
+	move(node->values.begin(), node->values.end(), back_inserter(moved->values));
+	moved->children.reserve(node->children.size());
+	moved->children.assign(node->children.begin(), node->children.end());
+	moved->parent = node->parent;
+	moved->summary = node->summary;
+	moved->lastAccess = node->lastAccess;
+	moved->Adopt();
+
+	if (node->parent == nullptr)
+		this->root = moved;
+	else
+		*find(node->parent->children.begin(), node->parent->children.end(), node) = moved;
+
+	// the children now belong to the moved node
+	node->children.clear();
+	delete node;
+
+	return moved;
+}
+
+/**
+ * Moves the upper levels of a subtree in van Emde Boas order - the upper half of the levels first,
+ * then each subtree below them, both laid out the same way.
+ * 
+ * \param node The root of the subtree
+ * \param levels The number of levels to move
+ * \param relocated The counter of moved nodes
+ * \return The moved root of the subtree
+ */
+template <class T, class Monoid>
+typename BTree<T, Monoid>::Node* BTree<T, Monoid>::InternalRelocateVeb(Node* node, int levels, int& relocated)
+{
+	if (levels == 1)
+	{
+		relocated++;
+		return RelocateNode(node);
+	}
+
+	int topLevels = levels / 2;
+	Node* moved = InternalRelocateVeb(node, topLevels, relocated);
+
+	// the roots of the lower subtrees are topLevels below
+	vector<Node*> bottoms(1, moved);
+	for (int i = 0; i < topLevels; i++)
+	{
+		vector<Node*> next;
+		for (auto bottom : bottoms)
+			next.insert(next.end(), bottom->children.begin(), bottom->children.end());
+		bottoms = move(next);
+	}
+
+	for (auto bottom : bottoms)
+		InternalRelocateVeb(bottom, levels - topLevels, relocated);
+
+	return moved;
+}
+
+/**
+ * Finds the first node of a level, or the first one whose first value is greater than a key.
+ * 
+ * \param level The level, the root being level 0
+ * \param after Whether to look for a node after the key, otherwise the first node is returned
+ * \param key The key
+ * \return The node, nullptr if there is no such node
+ */
+template <class T, class Monoid>
+typename BTree<T, Monoid>::Node* BTree<T, Monoid>::InternalFindAtLevel(int level, bool after, const T& key)
+{
+	Node* node = this->root;
+
+	// goes down to where the key would be on that level
+	for (int depth = 0; depth < level; depth++)
+		node = node->children[after ? upper_bound(node->values.begin(), node->values.end(), key) - node->values.begin() : 0];
+
+	if (!after || key < node->values[0])
+		return node;
+
+	// otherwise it is the next node on the level - up until there is a right sibling, then down its left edge
+	int climbed = 0;
+	while (node->parent != nullptr && node->GetIndex() == node->parent->children.size() - 1)
+	{
+		node = node->parent;
+		climbed++;
+	}
+
+	if (node->parent == nullptr)
+		return nullptr;
+
+	node = node->parent->children[node->GetIndex() + 1];
+	for (; climbed > 0; climbed--)
+		node = node->children[0];
+
+	return node;
+}
+
+/**
+ * Moves the nodes into contiguous blocks of memory in breadth-first or van Emde Boas order and shrinks
+ * their buffers to fit. The work can be done in steps between other operations, the pass remembers
+ * the last moved node by its level and first value, and starts over if the height of the tree changes.
+ * 
+ * \param order The order to lay the nodes out in, switching it starts a new pass
+ * \param maxNodes The maximal number of nodes to move, -1 for no limit. A van Emde Boas step always moves a whole subtree
+ * \return True if the pass is done, false if there is more work left
+ */
+template <class T, class Monoid>
+bool BTree<T, Monoid>::Defragment(DefragmentOrder order, int maxNodes)
+{
+	if (this->root == nullptr)
+	{
+		this->defragmenting = false;
+		return true;
+	}
+
+	ThawAll();
+
+	if (!this->defragmenting || order != this->defragmentOrder || this->height != this->defragmentHeight)
+	{
+		this->defragmenting = true;
+		this->defragmentOrder = order;
+		this->defragmentHeight = this->height;
+		this->defragmentLevel = order == DefragmentOrder::BreadthFirst ? 0 : -1;
+		this->defragmentStarted = false;
+	}
+
+	this->defragmentArenaCapacity = maxNodes > 0 ? maxNodes : GetNodeCount();
+
+	// van Emde Boas moves the upper half of the levels at once, then each subtree hanging below them
+	int bottomLevel = this->height / 2;
+
+	int relocated = 0;
+	while (maxNodes < 0 || relocated < maxNodes)
+	{
+		if (this->defragmentLevel == -1)
+		{
+			if (bottomLevel > 0)
+				InternalRelocateVeb(this->root, bottomLevel, relocated);
+
+			this->defragmentLevel = bottomLevel;
+			continue;
+		}
+
+		Node* node = InternalFindAtLevel(this->defragmentLevel, this->defragmentStarted, this->defragmentKey);
+
+		if (node == nullptr)
+		{
+			if (order == DefragmentOrder::BreadthFirst && this->defragmentLevel + 1 < this->height)
+			{
+				this->defragmentLevel++;
+				this->defragmentStarted = false;
+				continue;
+			}
+
+			this->defragmenting = false;
+			break;
+		}
+
+		this->defragmentStarted = true;
+		this->defragmentKey = node->values[0];
+
+		if (order == DefragmentOrder::BreadthFirst)
+		{
+			RelocateNode(node);
+			relocated++;
+		}
+		else
+		{
+			InternalRelocateVeb(node, this->height - bottomLevel, relocated);
+		}
+	}
+
+	// the rest of the arena stays unused, it is freed with its last node
+	if (this->defragmentArena != nullptr)
+	{
+		this->defragmentArena->Seal();
+		this->defragmentArena = nullptr;
+	}
+
+	return !this->defragmenting;
+}
+
+/**
+ * Gets the average number of splits, borrows and merges per insert or remove.
+ * 
+ * \return The number of structural changes per operation
+ */
+template <class T, class Monoid>
+double BTree<T, Monoid>::GetStructuralChangesPerOperation()
+{
+	if (this->operationCount == 0)
+		return 0;
+
+	return (double)this->structuralChanges / (double)this->operationCount;
+}
+
+/**
+ * Gets the counters of the work done by the tree, they are all zero unless BTREE_INSTRUMENTATION is defined.
+ * 
+ * \return The counters
+ */
+template <class T, class Monoid>
+BTreeCounters BTree<T, Monoid>::GetCounters()
+{
+#ifdef BTREE_INSTRUMENTATION
+	return this->counters;
+#else
+	return BTreeCounters();
+#endif
+}
+
+/**
+ * Sets all counters back to zero.
+ */
+template <class T, class Monoid>
+void BTree<T, Monoid>::ResetCounters()
+{
+#ifdef BTREE_INSTRUMENTATION
+	this->counters = BTreeCounters();
+#endif
+}
+
+/**
+ * Sets where the latencies of sampled inserts, finds and removes are recorded. The recorder can be shared by many trees.
+ * 
+ * \param recorder The recorder, nullptr to stop recording
+ */
+template <class T, class Monoid>
+void BTree<T, Monoid>::SetLatencyRecorder(LatencyRecorder* recorder)
+{
+	this->latencyRecorder = recorder;
+}
+
+/**
+ * Sets the callback called on every split, borrow, merge and root change, and after every sampled operation.
+ * The events of one operation share its id, so slow operations can be matched with the changes they made.
+ * 
+ * \param callback The callback, empty to stop tracing
+ */
+template <class T, class Monoid>
+void BTree<T, Monoid>::SetTraceCallback(const function<void(const TraceEvent&)>& callback)
+{
+	this->traceCallback = callback;
+}
+
+/**
+ * Sets where the inserts, finds, removes, scans and range removes are recorded, so the workload can be replayed later.
+ * 
+ * \param writer The writer, nullptr to stop recording
+ */
+template <class T, class Monoid>
+void BTree<T, Monoid>::SetTraceWriter(TraceWriter<T>* writer)
+{
+	this->traceWriter = writer;
+}
+
+/**
+ * Starts an operation and decides whether it will be timed.
+ * 
+ * \param type The type of the operation
+ * \return True if the operation is timed
+ */
+template <class T, class Monoid>
+bool BTree<T, Monoid>::BeginOperation(OperationType type)
+{
+	this->currentOperation = type;
+	this->operationId++;
+
+	if (this->latencyRecorder == nullptr || !this->latencyRecorder->ShouldSample())
+		return false;
+
+	this->operationStart = chrono::steady_clock::now();
+	return true;
+}
+
+/**
+ * Finishes the operation in progress and records its latency if it was timed.
+ * 
+ * \param sampled Whether the operation was timed
+ */
+template <class T, class Monoid>
+void BTree<T, Monoid>::EndOperation(bool sampled)
+{
+	if (sampled)
+	{
+		long long latency = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - this->operationStart).count();
+		this->latencyRecorder->Record(this->currentOperation, latency);
+
+		if (this->traceCallback)
+			this->traceCallback(TraceEvent{ TraceEventType::Operation, this->currentOperation, this->operationId, 0, latency });
+	}
+
+	this->currentOperation = OperationType::Other;
+}
+
+/**
+ * Reports a structural change to the trace callback, if there is one, and counts the node it created or deleted.
+ * 
+ * \param type The kind of the change
+ * \param node The node changed
+ */
+template <class T, class Monoid>
+void BTree<T, Monoid>::Trace(TraceEventType type, Node* node)
+{
+	if (type == TraceEventType::Split || type == TraceEventType::RootGrow)
+		this->hotNodes++;
+	else if (type == TraceEventType::Merge || type == TraceEventType::RootShrink)
+		this->hotNodes--;
+
+	if (this->traceCallback)
+		this->traceCallback(TraceEvent{ type, this->currentOperation, this->operationId, (int)node->values.size(), 0 });
+}
+
+/**
+ * Splits the tree at a key. This tree keeps the values lower than the key, the rest is moved to a new tree.
+ * 
+ * \param key The key to split at
+ * \return The tree with the values from the key up
+ */
+template <class T, class Monoid>
+BTree<T, Monoid>* BTree<T, Monoid>::Split(T key)
+{
+	BTree<T, Monoid>* higher = MakeNodeTree();
+
+	if (this->isFlat)
+	{
+		auto it = lower_bound(this->flat.begin(), this->flat.end(), key);
+		higher->flat.assign(it, this->flat.end());
+		higher->isFlat = true;
+		this->flat.erase(it, this->flat.end());
+
+		return higher;
+	}
+
+	if (this->root == nullptr)
+	{
+		higher->isFlat = true;
+		return higher;
+	}
+
+	ThawAll();
+
+	Node* left;
+	Node* right;
+	int leftHeight, rightHeight;
+	bool found;
+	T removed = key;
+	this->InternalSplitAt(this->root, this->height, key, left, leftHeight, found, removed, right, rightHeight);
+
+	this->root = left;
+	this->height = leftHeight;
+	this->hotCounted = false;
+
+	higher->root = right;
+	higher->height = rightHeight;
+
+	// the stored value equal to the key belongs to the higher part, with its count or payloads
+	if (found)
+		higher->InternalInsert(higher->root, removed);
+
+	this->DemoteIfSmall();
+	higher->DemoteIfSmall();
+
+	return higher;
+}
+
+/**
+ * Joins two trees and a pivot between them into a new tree. All values of the left tree have to be lower
+ * than the pivot and all values of the right tree higher. Both trees are left empty.
+ * 
+ * \param left The tree with the lower values
+ * \param pivot The value between the two trees
+ * \param right The tree with the higher values
+ * \return The joined tree, nullptr if the trees can't be joined
+ */
+template <class T, class Monoid>
+BTree<T, Monoid>* BTree<T, Monoid>::Join(BTree<T, Monoid>* left, T pivot, BTree<T, Monoid>* right)
+{
+	if (left->order != right->order)
+	{
+		cout << "trees of order " << left->order << " and " << right->order << " can't be joined" << endl;
+		return nullptr;
+	}
+
+	left->Promote();
+	right->Promote();
+	left->ThawAll();
+	right->ThawAll();
+
+	if ((left->root != nullptr && !(left->root->GetMostRightChild()->values.back() < pivot))
+		|| (right->root != nullptr && !(pivot < right->root->GetMostLeftChild()->values.front())))
+	{
+		cout << "the pivot " << pivot << " doesn't separate the trees" << endl;
+		return nullptr;
+	}
+
+	BTree<T, Monoid>* joined = left->MakeNodeTree();
+	joined->relaxedDeletion = left->relaxedDeletion || right->relaxedDeletion;
+	joined->accessClock = max(left->accessClock, right->accessClock);
+	joined->InternalJoin(left->root, left->height, pivot, right->root, right->height);
+	joined->SettleDeletionMode(left->relaxedDeletion);
+	joined->DemoteIfSmall();
+
+	left->root = nullptr;
+	left->height = 0;
+	right->root = nullptr;
+	right->height = 0;
+
+	return joined;
+}
+
+/**
+ * Unites two trees into a new tree. Both trees are left empty.
+ * 
+ * \param a The first tree
+ * \param b The second tree
+ * \return The tree with the values present in either tree, nullptr if the trees differ in order
+ */
+template <class T, class Monoid>
+BTree<T, Monoid>* BTree<T, Monoid>::Union(BTree<T, Monoid>* a, BTree<T, Monoid>* b)
+{
+	if (a->order != b->order)
+	{
+		cout << "trees of order " << a->order << " and " << b->order << " can't be united" << endl;
+		return nullptr;
+	}
+
+	a->Promote();
+	b->Promote();
+	a->ThawAll();
+	b->ThawAll();
+
+	BTree<T, Monoid>* result = a->MakeNodeTree();
+	result->relaxedDeletion = a->relaxedDeletion || b->relaxedDeletion;
+	result->accessClock = max(a->accessClock, b->accessClock);
+	result->InternalUnion(a->root, a->height, b->root, b->height);
+	result->SettleDeletionMode(a->relaxedDeletion);
+	result->DemoteIfSmall();
+
+	a->root = nullptr;
+	a->height = 0;
+	b->root = nullptr;
+	b->height = 0;
+
+	return result;
+}
+
+/**
+ * Intersects two trees into a new tree. Both trees are left empty.
+ * 
+ * \param a The first tree
+ * \param b The second tree
+ * \return The tree with the values present in both trees, nullptr if the trees differ in order
+ */
+template <class T, class Monoid>
+BTree<T, Monoid>* BTree<T, Monoid>::Intersect(BTree<T, Monoid>* a, BTree<T, Monoid>* b)
+{
+	if (a->order != b->order)
+	{
+		cout << "trees of order " << a->order << " and " << b->order << " can't be intersected" << endl;
+		return nullptr;
+	}
+
+	a->Promote();
+	b->Promote();
+	a->ThawAll();
+	b->ThawAll();
+
+	BTree<T, Monoid>* result = a->MakeNodeTree();
+	result->relaxedDeletion = a->relaxedDeletion || b->relaxedDeletion;
+	result->accessClock = max(a->accessClock, b->accessClock);
+	result->InternalIntersect(a->root, a->height, b->root, b->height);
+	result->SettleDeletionMode(a->relaxedDeletion);
+	result->DemoteIfSmall();
+
+	a->root = nullptr;
+	a->height = 0;
+	b->root = nullptr;
+	b->height = 0;
+
+	return result;
+}
+
+/**
+ * Subtracts one tree from another into a new tree. Both trees are left empty.
+ * 
+ * \param a The tree to subtract from
+ * \param b The tree to subtract
+ * \return The tree with the values of the first tree not present in the second, nullptr if the trees differ in order
  */
-template <class T>
-void BTree<T>::Remove(T value)
+template <class T, class Monoid>
+BTree<T, Monoid>* BTree<T, Monoid>::Difference(BTree<T, Monoid>* a, BTree<T, Monoid>* b)
 {
-	this->InternalRemove(this->root, value);
+	if (a->order != b->order)
+	{
+		cout << "trees of order " << a->order << " and " << b->order << " can't be subtracted" << endl;
+		return nullptr;
+	}
+
+	a->Promote();
+	b->Promote();
+	a->ThawAll();
+	b->ThawAll();
+
+	BTree<T, Monoid>* result = a->MakeNodeTree();
+	result->relaxedDeletion = a->relaxedDeletion || b->relaxedDeletion;
+	result->accessClock = max(a->accessClock, b->accessClock);
+	result->InternalDifference(a->root, a->height, b->root, b->height);
+	result->SettleDeletionMode(a->relaxedDeletion);
+	result->DemoteIfSmall();
+
+	a->root = nullptr;
+	a->height = 0;
+	b->root = nullptr;
+	b->height = 0;
+
+	return result;
 }
 
 /**
@@ -635,8 +3661,8 @@ void BTree<T>::Remove(T value)
  * 
  * \param value The value to insert
  */
-template <class T>
-void BTree<T>::InsertPrint(T value)
+template <class T, class Monoid>
+void BTree<T, Monoid>::InsertPrint(T value)
 {
 	cout << endl << BLACK << WHITE_B << "  Inserting " << value << "  " << RESET << endl;
 
@@ -649,8 +3675,8 @@ void BTree<T>::InsertPrint(T value)
  *
  * \param value The value to check for
  */
-template <class T>
-void BTree<T>::FindPrint(T value)
+template <class T, class Monoid>
+void BTree<T, Monoid>::FindPrint(T value)
 {
 	cout << endl << BLACK << WHITE_B << "  Finding " << value << "  " << RESET << endl;
 
@@ -669,11 +3695,34 @@ void BTree<T>::FindPrint(T value)
  *
  * \param value The value to remove
  */
-template <class T>
-void BTree<T>::RemovePrint(T value)
+template <class T, class Monoid>
+void BTree<T, Monoid>::RemovePrint(T value)
 {
 	cout << endl << BLACK << WHITE_B << "  Removing " << value << "  " << RESET << endl;
 
 	Remove(value);
 	Print();
 }
+
+// the member functions are defined here and not in the header, so the trees used elsewhere are instantiated here
+template class BTree<int>;
+template class BTree<long long>;
+template class BTree<string>;
+template class BTree<Counted<int>>;
+template class BTree<Counted<long long>>;
+template class BTree<Counted<string>>;
+template class BTree<Posting<int, long long>>;
+template class BTree<Posting<long long, long long>>;
+template class BTree<Posting<string, long long>>;
+template class BTree<int, SumAggregate<int>>;
+template class BTree<int, MinAggregate<int>>;
+template class BTree<int, MaxAggregate<int>>;
+template class BTree<int, CountAggregate<int>>;
+template class BTree<long long, SumAggregate<long long>>;
+template class BTree<long long, MinAggregate<long long>>;
+template class BTree<long long, MaxAggregate<long long>>;
+template class BTree<long long, CountAggregate<long long>>;
+template class BTree<string, CountAggregate<string>>;
+template class BTree<Counted<int>, CountAggregate<Counted<int>>>;
+template class BTree<Counted<long long>, CountAggregate<Counted<long long>>>;
+template class BTree<Counted<string>, CountAggregate<Counted<string>>>;
@@ -12,13 +12,30 @@
 #include <queue>
 #include <algorithm>
 #include <cmath>
+#include <functional>
+#include <utility>
+#include <chrono>
+#include <fstream>
+#include <type_traits>
+#include <unordered_set>
+#include "ThreadPool.h"
+#include "Aggregate.h"
+#include "Instrumentation.h"
+#include "Latency.h"
+#include "Multiset.h"
+#include "WorkloadTrace.h"
+#include "Export.h"
+#include "NodeArena.h"
+#include "PagedTree.h"
+#include "ColdTier.h"
 
 using namespace std;
 
 /**
  * \brief A B-Tree containing the order of the tree and a pointer to the root.
+ * The monoid decides which summary (sum, minimum, ...) each node keeps of its subtree, see Aggregate.h.
  */
-template <class T>
+template <class T, class Monoid = NoAggregate<T>>
 class BTree
 {
 private:
@@ -34,6 +51,12 @@ private:
 		vector<Node*> children;
 		/** The parent of this node */
 		Node* parent;
+		/** The summary of the values of this node and its children */
+		typename Monoid::Value summary;
+		/** The values and the shape of the subtree while it is cold, its values and children are empty then */
+		ColdBlock* cold;
+		/** The access clock of the tree when the node was last descended into */
+		unsigned long long lastAccess;
 
 		/**
 		 * Constructs the node.
@@ -41,6 +64,9 @@ private:
 		Node()
 		{
 			this->parent = nullptr;
+			this->summary = Monoid::Identity();
+			this->cold = nullptr;
+			this->lastAccess = 0;
 		}
 		
 		/**
@@ -54,8 +80,55 @@ private:
 			values.push_back(value);
 
 			this->parent = parent;
+			this->summary = Monoid::Identity();
+			this->cold = nullptr;
+			this->lastAccess = 0;
 		}
 		
+		/**
+		 * Allocates a node on its own.
+		 * 
+		 * \param size The size of the node
+		 * \return The memory for the node
+		 */
+		static void* operator new(size_t size)
+		{
+			return NodeArena::AllocateSingle(size);
+		}
+
+		/**
+		 * Allocates a node in an arena.
+		 * 
+		 * \param size The size of the node
+		 * \param arena The arena
+		 * \return The memory for the node
+		 */
+		static void* operator new(size_t size, NodeArena* arena)
+		{
+			return arena->Allocate(size);
+		}
+
+		/**
+		 * Frees a node, wherever it was allocated.
+		 * 
+		 * \param pointer The memory of the node
+		 */
+		static void operator delete(void* pointer)
+		{
+			NodeArena::Free(pointer);
+		}
+
+		/**
+		 * Frees a node allocated in an arena whose constructor failed.
+		 * 
+		 * \param pointer The memory of the node
+		 * \param arena The arena
+		 */
+		static void operator delete(void* pointer, NodeArena* arena)
+		{
+			NodeArena::Free(pointer);
+		}
+
 		/**
 		 * Destructs the node along with its children.
 		 * 
@@ -64,6 +137,8 @@ private:
 		{
 			for (auto child : children)
 				delete child;
+
+			delete cold;
 		}
 		
 		/**
@@ -233,7 +308,7 @@ private:
 			{
 				cout << val << " ";
 			}
-			cout << ")" << endl;
+			cout << ")\n";
 		}
 	};
 
@@ -241,14 +316,153 @@ private:
 	Node* root = nullptr;
 	/** The order of the tree */
 	int order;
+	/** The number of levels of the tree, 0 if it is empty */
+	int height = 0;
+
+	/** The values while the tree is small, sorted in a single array instead of nodes */
+	vector<T> flat;
+	/** Whether the values are kept in the flat array, the root is nullptr then */
+	bool isFlat = true;
+	/** The most values the flat array holds before the tree is promoted to nodes, 0 to always use nodes */
+	int flatCapacity = 128;
+	/** Whether a tree shrunk to half of the flat capacity is demoted back to the flat array */
+	bool flatDemotion = true;
 
-	void InternalInsert(Node* node, T value);
+	/** The most bytes the nodes may hold before the least recently used subtrees are made cold, 0 to keep all in nodes */
+	size_t hotBudget = 0;
+	/** The number of operations between two checks of the budget */
+	int tierInterval = 4096;
+	/** Counts the operations, the nodes remember its value when they are descended into */
+	unsigned long long accessClock = 0;
+	/** The number of cold subtrees */
+	int coldCount = 0;
+	/** The number of subtrees made cold so far */
+	long long freezeCount = 0;
+	/** The number of cold subtrees thawed so far */
+	long long thawCount = 0;
+	/** The number of nodes outside of cold blocks, counted by the structural changes, freezes and thaws */
+	long long hotNodes = 0;
+	/** The bytes held per hot node when the nodes were last measured */
+	size_t hotNodeBytes = 0;
+	/** Whether hotNodes is exact, operations on whole trees take the nodes apart without counting them */
+	bool hotCounted = false;
+
+	/** Whether nodes are only rebalanced once they run empty */
+	bool relaxedDeletion = false;
+	/** Whether Compact is running, which enforces the regular minimum even with relaxed deletion */
+	bool compacting = false;
+	/** The first values of the nodes Compact still has to fix */
+	vector<T> compactPending;
+
+	/** The number of inserts and removes done */
+	long long operationCount = 0;
+	/** The number of splits, borrows and merges done */
+	long long structuralChanges = 0;
+
+#ifdef BTREE_INSTRUMENTATION
+	/** The counters of the work done on the hot paths */
+	BTreeCounters counters;
+#endif
+
+	/** Records the latencies of sampled operations, nullptr to record nothing */
+	LatencyRecorder* latencyRecorder = nullptr;
+	/** Receives the structural changes and the sampled operations, empty to report nothing */
+	function<void(const TraceEvent&)> traceCallback;
+	/** The operation in progress, Other outside of inserts, finds and removes */
+	OperationType currentOperation = OperationType::Other;
+	/** The id of the last started operation */
+	long long operationId = 0;
+	/** When the timed operation in progress started */
+	chrono::steady_clock::time_point operationStart;
+	/** Records the operations for a replay, nullptr to record nothing */
+	TraceWriter<T>* traceWriter = nullptr;
+
+	/** Whether a defragmentation pass is in progress */
+	bool defragmenting = false;
+	/** The order of the pass in progress */
+	DefragmentOrder defragmentOrder = DefragmentOrder::BreadthFirst;
+	/** The height of the tree when the pass started, the pass starts over if it changes */
+	int defragmentHeight = 0;
+	/** The level whose nodes (or subtrees) the pass is relocating */
+	int defragmentLevel = 0;
+	/** Whether a node of that level was relocated already, its first value is then in defragmentKey */
+	bool defragmentStarted = false;
+	/** The first value of the last node relocated on that level */
+	T defragmentKey;
+	/** The arena the nodes are relocated into, only during Defragment */
+	NodeArena* defragmentArena = nullptr;
+	/** The number of nodes each new arena can hold */
+	int defragmentArenaCapacity = 0;
+
+	bool InternalInsert(Node* node, T value);
 	void InternalSplit(Node* node);
+
+	void Touch(Node* node);
+	void Tick();
+	void Freeze(Node* node);
+	void Thaw(Node* node);
+	void InternalDecode(Node* node, const ColdBlock& block);
+	Node* DecodeCopy(Node* node);
+	void InternalThawAll(Node* node);
+	Node* ThawedMostLeft(Node* node);
+	Node* ThawedMostRight(Node* node);
+	void InternalEncodeShape(Node* node, ColdBlock& block);
+	void InternalEncodeValues(Node* node, ColdBlock& block, T& previous);
+	void InternalDecodeShape(Node* node, int nodeHeight, const char*& position);
+	void InternalDecodeValues(Node* node, const char*& position, T& previous);
+	void InternalCollectColdCandidates(Node* node, int nodeHeight, int candidateHeight, vector<Node*>& candidates);
+
+	void Promote();
+	void DemoteIfSmall();
+	BTree<T, Monoid>* MakeNodeTree();
+	void SettleDeletionMode(bool relaxed);
+	void FlatForEachInRange(const T& lo, const T& hi, const function<void(const T&)>& callback);
 	bool InternalFind(Node* node, T value);
-	void InternalRemove(Node* node, T value);
+	bool InternalRemove(Node* node, T value);
 	void InternalRebalance(Node* node);
+	void InternalRepair(Node* node);
+
+	bool BeginOperation(OperationType type);
+	void EndOperation(bool sampled);
+	void Trace(TraceEventType type, Node* node);
+
+	int GetMinAllowed();
+	Node* InternalFindNode(Node* node, T value);
+	void InternalCollectUnderfull(Node* node, vector<T>& values);
+
+	void InternalJoin(Node* left, int leftHeight, T pivot, Node* right, int rightHeight);
+	void InternalConcat(Node* left, int leftHeight, Node* right, int rightHeight);
+	void InternalSplitAt(Node* node, int nodeHeight, const T& key, Node*& left, int& leftHeight, bool& found, T& removed, Node*& right, int& rightHeight);
+	void InternalUnion(Node* a, int aHeight, Node* b, int bHeight);
+	void InternalIntersect(Node* a, int aHeight, Node* b, int bHeight);
+	void InternalDifference(Node* a, int aHeight, Node* b, int bHeight);
+	void InternalSplitByRoot(Node* a, Node* b, int bHeight, vector<Node*>& pieces, vector<int>& pieceHeights, vector<bool>& found, vector<T>& removed);
+
+	Node* RelocateNode(Node* node);
+	Node* InternalRelocateVeb(Node* node, int levels, int& relocated);
+	Node* InternalFindAtLevel(int level, bool after, const T& key);
+	void InternalMemoryUsage(Node* node, TreeMemoryUsage& usage, unordered_set<NodeArena*>& arenas);
+
+	void InternalPrint(Node* node, string& indent, bool last, int siblings, int position);
+	void ExportKeys(Node* node, ExportBuffer& out, const ExportOptions& options, bool json);
+	void InternalExportOutline(Node* node, ExportBuffer& out, const ExportOptions& options, string& indent, int depth, int position);
+	long long InternalExportDot(Node* node, ExportBuffer& out, const ExportOptions& options, int depth, long long& nextId);
+	void InternalExportJson(Node* node, ExportBuffer& out, const ExportOptions& options, int depth);
 
-	void InternalPrint(Node* node, string indent, bool last, int siblings, int position);
+	void RefreshSummary(Node* node);
+	void RefreshPath(Node* node);
+	typename Monoid::Value InternalAggregate(Node* node, const T& lo, const T& hi, bool aboveLo, bool belowHi);
+
+	void InternalCollect(Node* node, vector<T>& values);
+	int InternalValueCount(Node* node);
+	long long InternalMultiplicity(Node* node);
+	int InternalValueCountUpTo(Node* node, int limit);
+	int InternalHotNodeCount(Node* node);
+	void InternalForEachInRange(Node* node, const T& lo, const T& hi, const function<void(const T&)>& callback);
+	vector<Node*> InternalBuildLevel(const vector<T>& keys, const vector<Node*>& below, vector<T>& separators, ThreadPool& pool);
+	static void ParallelSort(vector<T>& values, ThreadPool& pool);
+
+	bool InternalValidate(Node* node, int depth, const T* lo, const T* hi);
 
 	int GetNodeCount();
 	int GetValueCount();
@@ -262,10 +476,55 @@ public:
 	void Insert(T value);
 	bool Find(T value);
 	void Remove(T value);
+	bool TryInsert(T value);
+	bool TryRemove(T value);
+
+	void InsertN(T value, long long count);
+	long long Count(T value);
+	const T* Lookup(T value);
+
+	void BulkLoad(vector<T> values, ThreadPool* pool = nullptr);
+	void ForEachRange(T lo, T hi, const function<void(const T&)>& callback);
+	void ParallelForEachRange(const vector<pair<T, T>>& ranges, const function<void(int, const T&)>& callback, ThreadPool* pool = nullptr);
+
+	long long RemoveRange(T lo, T hi);
+
+	typename Monoid::Value Aggregate(T lo, T hi);
+
+	void SetFlatCapacity(int capacity, bool demote = true);
+	bool IsFlat();
+
+	void SetRelaxedDeletion(bool relaxed);
+	bool Compact(int maxSteps = -1);
+	double GetStructuralChangesPerOperation();
+
+	TreeMemoryUsage MemoryUsage();
+	void SetTiering(size_t hotBudget, int interval = 4096);
+	int FreezeCold();
+	void ThawAll();
+	bool Defragment(DefragmentOrder order = DefragmentOrder::BreadthFirst, int maxNodes = -1);
+
+	BTreeCounters GetCounters();
+	void ResetCounters();
+
+	void SetLatencyRecorder(LatencyRecorder* recorder);
+	void SetTraceCallback(const function<void(const TraceEvent&)>& callback);
+	void SetTraceWriter(TraceWriter<T>* writer);
+
+	BTree<T, Monoid>* Split(T key);
+	static BTree<T, Monoid>* Join(BTree<T, Monoid>* left, T pivot, BTree<T, Monoid>* right);
+	static BTree<T, Monoid>* Union(BTree<T, Monoid>* a, BTree<T, Monoid>* b);
+	static BTree<T, Monoid>* Intersect(BTree<T, Monoid>* a, BTree<T, Monoid>* b);
+	static BTree<T, Monoid>* Difference(BTree<T, Monoid>* a, BTree<T, Monoid>* b);
+
+	bool Validate();
 
 	void PrintInfo();
 	void PrintStats();
 	void Print();
+	void Export(ostream& stream, const ExportOptions& options = ExportOptions());
+	bool ExportToFile(const string& path, const ExportOptions& options = ExportOptions());
+	bool WritePages(const string& path, int pageSize = 4096);
 
 	void InsertPrint(T value);
 	void FindPrint(T value);
@@ -0,0 +1,134 @@
+/*****************************************************************//**
+ * \file   ColdTier.h
+ * \brief  The compact encoding of cold subtrees, kept compressed in memory until they are needed again
+ *
+ * A cold block holds the number of values of every node of a subtree in pre-order, followed by
+ * all its values in ascending order. Integer values are stored as zigzag varint deltas from the previous
+ * value, strings as the length of the prefix shared with the previous string and the rest of the bytes.
+ * Counted values are followed by their count as a varint.
+ *
+ * \author Kkobari
+ * \date   November 2022
+ *********************************************************************/
+
+#pragma once
+#include <vector>
+#include <string>
+#include "Multiset.h"
+#include "Varint.h"
+
+using namespace std;
+
+/**
+ * \brief A subtree compressed into a block of bytes.
+ */
+struct ColdBlock
+{
+	/** The encoded node sizes and values */
+	vector<char> bytes;
+	/** The number of levels of the subtree */
+	int height = 0;
+	/** The number of nodes of the subtree */
+	int nodeCount = 0;
+	/** The number of values of the subtree */
+	int valueCount = 0;
+};
+
+/*
+ * The cold codec tells the tree how to encode its values into a cold block. It provides:
+ *   enabled                           - whether the values can be encoded, subtrees of other values stay in nodes
+ *   Encode(bytes, previous, value)    - appends a value, previous is the value appended before it and is replaced with it
+ *   Decode(position, previous, value) - reads a value, previous is the value read before it and is replaced with it
+ */
+
+/**
+ * \brief The default codec, the values can't be encoded.
+ */
+template <class T>
+struct ColdCodec
+{
+	static constexpr bool enabled = false;
+
+	static void Encode(vector<char>& bytes, T& previous, const T& value) {}
+	static void Decode(const char*& position, T& previous, T& value) {}
+};
+
+/**
+ * \brief Encodes integers as the zigzag encoded difference from the previous value, ascending values take a byte or two.
+ */
+template <class I>
+struct ColdIntegerCodec
+{
+	static constexpr bool enabled = true;
+
+	static void Encode(vector<char>& bytes, I& previous, const I& value)
+	{
+		Varint::Put(bytes, Varint::ZigzagDelta(previous, value));
+		previous = value;
+	}
+
+	static void Decode(const char*& position, I& previous, I& value)
+	{
+		value = (I)Varint::AddZigzagDelta(previous, Varint::Get(position));
+		previous = value;
+	}
+};
+
+template <>
+struct ColdCodec<int> : ColdIntegerCodec<int> {};
+
+template <>
+struct ColdCodec<long long> : ColdIntegerCodec<long long> {};
+
+/**
+ * \brief Encodes strings without the prefix they share with the previous string, which ascending strings often do.
+ */
+template <>
+struct ColdCodec<string>
+{
+	static constexpr bool enabled = true;
+
+	static void Encode(vector<char>& bytes, string& previous, const string& value)
+	{
+		size_t shared = 0;
+		while (shared < previous.size() && shared < value.size() && previous[shared] == value[shared])
+			shared++;
+
+		Varint::Put(bytes, shared);
+		Varint::Put(bytes, value.size() - shared);
+		bytes.insert(bytes.end(), value.begin() + shared, value.end());
+		previous = value;
+	}
+
+	static void Decode(const char*& position, string& previous, string& value)
+	{
+		size_t shared = Varint::Get(position);
+		size_t rest = Varint::Get(position);
+
+		value.assign(previous, 0, shared);
+		value.append(position, rest);
+		position += rest;
+		previous = value;
+	}
+};
+
+/**
+ * \brief Encodes counted values as their key and their count.
+ */
+template <class K>
+struct ColdCodec<Counted<K>>
+{
+	static constexpr bool enabled = ColdCodec<K>::enabled;
+
+	static void Encode(vector<char>& bytes, Counted<K>& previous, const Counted<K>& value)
+	{
+		ColdCodec<K>::Encode(bytes, previous.key, value.key);
+		Varint::Put(bytes, value.count);
+	}
+
+	static void Decode(const char*& position, Counted<K>& previous, Counted<K>& value)
+	{
+		ColdCodec<K>::Decode(position, previous.key, value.key);
+		value.count = Varint::Get(position);
+	}
+};
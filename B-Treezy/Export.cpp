@@ -0,0 +1,207 @@
+/*****************************************************************//**
+ * \file   Export.cpp
+ * \brief  Buffered streaming export of the tree
+ * 
+ * \author Kkobari
+ * \date   November 2022
+ *********************************************************************/
+
+#include "Export.h"
+
+/**
+ * Constructs the buffer.
+ * 
+ * \param stream The stream to write to
+ * \param capacity The size at which the buffer is written out
+ */
+ExportBuffer::ExportBuffer(ostream& stream, size_t capacity) : stream(stream)
+{
+	this->capacity = capacity < 64 ? 64 : capacity;
+	buffer.reserve(this->capacity + 64);
+}
+
+/**
+ * Writes the rest of the buffer.
+ */
+ExportBuffer::~ExportBuffer()
+{
+	Flush();
+}
+
+/**
+ * Writes a character.
+ * 
+ * \param character The character
+ */
+void ExportBuffer::Put(char character)
+{
+	buffer.push_back(character);
+
+	if (buffer.size() >= capacity)
+		Flush();
+}
+
+/**
+ * Writes a text.
+ * 
+ * \param text The text
+ */
+void ExportBuffer::Put(const char* text)
+{
+	while (*text != '\0')
+		Put(*text++);
+}
+
+/**
+ * Writes a number.
+ * 
+ * \param number The number
+ */
+void ExportBuffer::Put(long long number)
+{
+	char digits[24];
+	int count = 0;
+
+	// works on the magnitude as unsigned, so the lowest number doesn't overflow
+	unsigned long long magnitude = number < 0 ? 0 - (unsigned long long)number : number;
+	do
+	{
+		digits[count++] = '0' + magnitude % 10;
+		magnitude /= 10;
+	} while (magnitude != 0);
+
+	if (number < 0)
+		Put('-');
+
+	while (count > 0)
+		Put(digits[--count]);
+}
+
+/**
+ * Writes a text so it can be put between double quotes in a Graphviz label. DOT has no escape for
+ * control characters, so they are shown as a backslash, an x and their hex code.
+ * 
+ * \param text The text
+ * \param length The length of the text
+ */
+void ExportBuffer::PutDotEscaped(const char* text, size_t length)
+{
+	static const char hex[] = "0123456789abcdef";
+
+	for (size_t i = 0; i < length; i++)
+	{
+		unsigned char character = text[i];
+
+		if (character == '"' || character == '\\')
+		{
+			Put('\\');
+			Put((char)character);
+		}
+		else if (character == '\n')
+		{
+			Put("\\n");
+		}
+		else if (character < 0x20)
+		{
+			Put("\\\\x");
+			Put(hex[character >> 4]);
+			Put(hex[character & 15]);
+		}
+		else
+		{
+			Put((char)character);
+		}
+	}
+}
+
+/**
+ * Writes a text so it can be put between double quotes in JSON.
+ * 
+ * \param text The text
+ * \param length The length of the text
+ */
+void ExportBuffer::PutJsonEscaped(const char* text, size_t length)
+{
+	static const char hex[] = "0123456789abcdef";
+
+	for (size_t i = 0; i < length; i++)
+	{
+		unsigned char character = text[i];
+
+		if (character == '"' || character == '\\')
+		{
+			Put('\\');
+			Put((char)character);
+		}
+		else if (character == '\n')
+		{
+			Put("\\n");
+		}
+		else if (character < 0x20)
+		{
+			Put("\\u00");
+			Put(hex[character >> 4]);
+			Put(hex[character & 15]);
+		}
+		else
+		{
+			Put((char)character);
+		}
+	}
+}
+
+/**
+ * Writes a number, which needs no escaping.
+ * 
+ * \param value The number
+ */
+void ExportBuffer::PutValue(int value, ExportEscape)
+{
+	Put((long long)value);
+}
+
+/**
+ * Writes a number, which needs no escaping.
+ * 
+ * \param value The number
+ */
+void ExportBuffer::PutValue(long long value, ExportEscape)
+{
+	Put(value);
+}
+
+/**
+ * Writes a text.
+ * 
+ * \param value The text
+ * \param escape How to escape quotes, backslashes and control characters
+ */
+void ExportBuffer::PutValue(const string& value, ExportEscape escape)
+{
+	if (escape == ExportEscape::Dot)
+	{
+		PutDotEscaped(value.data(), value.size());
+		return;
+	}
+
+	if (escape == ExportEscape::Json)
+	{
+		PutJsonEscaped(value.data(), value.size());
+		return;
+	}
+
+	for (char character : value)
+		Put(character);
+}
+
+/**
+ * Writes the buffer into the stream, without flushing the stream itself.
+ */
+void ExportBuffer::Flush()
+{
+	if (buffer.empty())
+		return;
+
+	stream.write(buffer.data(), buffer.size());
+	buffer.clear();
+}
@@ -0,0 +1,103 @@
+/*****************************************************************//**
+ * \file   Export.h
+ * \brief  Buffered streaming export of the tree as a text outline, Graphviz DOT or JSON
+ * 
+ * \author Kkobari
+ * \date   November 2022
+ *********************************************************************/
+
+#pragma once
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <string>
+
+using namespace std;
+
+/**
+ * \brief The formats the tree can be exported to.
+ */
+enum class ExportFormat
+{
+	/** An indented outline like Print, without colors */
+	Outline,
+	/** A Graphviz digraph, one record node per tree node */
+	Dot,
+	/** Nested objects with the keys and children of each node */
+	Json
+};
+
+/**
+ * \brief How the texts of the values are escaped.
+ */
+enum class ExportEscape
+{
+	/** Written as they are */
+	None,
+	/** For a quoted Graphviz label */
+	Dot,
+	/** For a JSON string */
+	Json
+};
+
+/**
+ * \brief What and how to export.
+ */
+struct ExportOptions
+{
+	/** The format */
+	ExportFormat format = ExportFormat::Outline;
+	/** The deepest level exported, the root being level 0, -1 for all levels */
+	int maxDepth = -1;
+	/** The most keys shown per node, picked evenly across the node, 0 for all keys */
+	int maxKeysPerNode = 0;
+	/** The size of the buffer the output is collected in before it is written to the stream */
+	size_t bufferSize = 1 << 16;
+};
+
+/**
+ * \brief Collects the output in its own buffer and writes it to the stream in large blocks,
+ * the rest is written when the buffer is flushed or destroyed.
+ */
+class ExportBuffer
+{
+private:
+	/** The stream written to */
+	ostream& stream;
+	/** The output not yet written to the stream */
+	vector<char> buffer;
+	/** The size at which the buffer is written out */
+	size_t capacity;
+	/** Formats values of types without their own overload, reused for all of them */
+	ostringstream scratch;
+
+public:
+	ExportBuffer(ostream& stream, size_t capacity);
+	~ExportBuffer();
+
+	void Put(char character);
+	void Put(const char* text);
+	void Put(long long number);
+	void PutDotEscaped(const char* text, size_t length);
+	void PutJsonEscaped(const char* text, size_t length);
+
+	void PutValue(int value, ExportEscape);
+	void PutValue(long long value, ExportEscape);
+	void PutValue(const string& value, ExportEscape escape);
+
+	/**
+	 * Writes a value using its output operator.
+	 * 
+	 * \param value The value
+	 * \param escape How to escape the text of the value
+	 */
+	template <class V>
+	void PutValue(const V& value, ExportEscape escape)
+	{
+		scratch.str("");
+		scratch << value;
+		PutValue(scratch.str(), escape);
+	}
+
+	void Flush();
+};
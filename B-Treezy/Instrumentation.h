@@ -0,0 +1,45 @@
+/*****************************************************************//**
+ * \file   Instrumentation.h
+ * \brief  Counters of the work done by the tree operations
+ * 
+ * The counters are only compiled in with BTREE_INSTRUMENTATION defined,
+ * otherwise BTREE_COUNT expands to nothing and the tree keeps no counters.
+ * 
+ * \author Kkobari
+ * \date   November 2022
+ *********************************************************************/
+
+#pragma once
+
+/**
+ * \brief The counters of a tree, all zero when instrumentation is compiled out.
+ */
+struct BTreeCounters
+{
+	/** The number of inserts, finds and removes */
+	long long operations = 0;
+	/** The number of nodes visited while descending */
+	long long nodesVisited = 0;
+	/** The number of comparisons of values while descending */
+	long long comparisons = 0;
+	/** The number of node splits */
+	long long splits = 0;
+	/** The number of times the tree got a level higher */
+	long long rootGrows = 0;
+	/** The number of times the tree got a level shorter */
+	long long rootShrinks = 0;
+	/** The number of values borrowed from a left sibling */
+	long long borrowsLeft = 0;
+	/** The number of values borrowed from a right sibling */
+	long long borrowsRight = 0;
+	/** The number of node merges */
+	long long merges = 0;
+	/** The number of nodes allocated */
+	long long allocations = 0;
+};
+
+#ifdef BTREE_INSTRUMENTATION
+#define BTREE_COUNT(counter, amount) (this->counters.counter += (amount))
+#else
+#define BTREE_COUNT(counter, amount) ((void)0)
+#endif
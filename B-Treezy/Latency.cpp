@@ -0,0 +1,286 @@
+/*****************************************************************//**
+ * \file   Latency.cpp
+ * \brief  Latency recording of the tree operations
+ * 
+ * \author Kkobari
+ * \date   November 2022
+ *********************************************************************/
+
+#include "Latency.h"
+#include <unordered_set>
+#include <algorithm>
+
+/**
+ * Gets the ids of the recorders not destroyed yet, the per-thread caches drop the others. Created on first use,
+ * so it outlives every recorder, even the global ones.
+ * 
+ * \param lock Receives the lock guarding the ids
+ * \return The ids
+ */
+static unordered_set<long long>& GetLiveRecorders(unique_lock<mutex>& lock)
+{
+	static mutex liveMutex;
+	static unordered_set<long long> live;
+
+	lock = unique_lock<mutex>(liveMutex);
+	return live;
+}
+
+/**
+ * Gets the bucket a value falls into.
+ * 
+ * \param value The value
+ * \return The index of the bucket
+ */
+int LatencyHistogram::BucketIndex(long long value)
+{
+	const int subBuckets = 1 << subBucketBits;
+
+	if (value < subBuckets)
+		return value < 0 ? 0 : value;
+
+	// position of the highest set bit
+	int highest = 0;
+	for (int step = 32; step > 0; step /= 2)
+	{
+		if ((value >> (highest + step)) != 0)
+			highest += step;
+	}
+
+	// the bits right below the highest one pick the bucket within its power of two
+	int shift = highest - subBucketBits;
+	int subBucket = (value >> shift) & (subBuckets - 1);
+
+	return (shift + 1) * subBuckets + subBucket;
+}
+
+/**
+ * Gets the highest value which falls into a bucket.
+ * 
+ * \param index The index of the bucket
+ * \return The highest value of the bucket
+ */
+long long LatencyHistogram::BucketUpperBound(int index)
+{
+	const int subBuckets = 1 << subBucketBits;
+
+	if (index < subBuckets)
+		return index;
+
+	int shift = index / subBuckets - 1;
+	int subBucket = index % subBuckets;
+
+	return ((long long)(subBuckets + subBucket + 1) << shift) - 1;
+}
+
+/**
+ * Constructs an empty histogram.
+ */
+LatencyHistogram::LatencyHistogram()
+{
+	counts.resize(bucketCount);
+}
+
+/**
+ * Records a value.
+ * 
+ * \param value The value to record
+ * \param count How many times to record it
+ */
+void LatencyHistogram::Record(long long value, long long count)
+{
+	counts[BucketIndex(value)] += count;
+	this->count += count;
+
+	if (value > max)
+		max = value;
+}
+
+/**
+ * Adds all values of another histogram to this one.
+ * 
+ * \param other The histogram to add
+ */
+void LatencyHistogram::Merge(const LatencyHistogram& other)
+{
+	for (int i = 0; i < bucketCount; i++)
+		counts[i] += other.counts[i];
+
+	count += other.count;
+
+	if (other.max > max)
+		max = other.max;
+}
+
+/**
+ * Gets the number of recorded values.
+ * 
+ * \return The number of values
+ */
+long long LatencyHistogram::GetCount()
+{
+	return count;
+}
+
+/**
+ * Gets the highest recorded value, known only to the precision of its bucket for merged thread histograms.
+ * 
+ * \return The highest value
+ */
+long long LatencyHistogram::GetMax()
+{
+	return max;
+}
+
+/**
+ * Gets the value below which a given share of the recorded values lie.
+ * 
+ * \param percentile The share in percent, e.g. 99
+ * \return The upper bound of the bucket holding the percentile, 0 if nothing was recorded
+ */
+long long LatencyHistogram::GetPercentile(double percentile)
+{
+	if (count == 0)
+		return 0;
+
+	long long rank = (long long)(percentile / 100 * count);
+	if (rank >= count)
+		rank = count - 1;
+
+	long long seen = 0;
+	for (int i = 0; i < bucketCount; i++)
+	{
+		seen += counts[i];
+		if (seen > rank)
+			return BucketUpperBound(i);
+	}
+
+	return max;
+}
+
+/**
+ * Constructs empty histograms.
+ */
+LatencyRecorder::ThreadHistograms::ThreadHistograms()
+{
+	for (auto& type : counts)
+	{
+		for (auto& bucket : type)
+			bucket.store(0, memory_order_relaxed);
+	}
+}
+
+/**
+ * Constructs the recorder.
+ * 
+ * \param sampleEvery Every how many operations of a thread one is timed, 1 times all of them
+ */
+LatencyRecorder::LatencyRecorder(int sampleEvery)
+{
+	static atomic<long long> nextId(0);
+
+	this->id = nextId++;
+	this->sampleEvery = sampleEvery < 1 ? 1 : sampleEvery;
+
+	unique_lock<mutex> lock;
+	GetLiveRecorders(lock).insert(this->id);
+}
+
+/**
+ * Destructs the recorder. The caches of the threads which used it drop their entries the next time they miss.
+ */
+LatencyRecorder::~LatencyRecorder()
+{
+	unique_lock<mutex> lock;
+	GetLiveRecorders(lock).erase(this->id);
+}
+
+/**
+ * Gets the histograms of the calling thread, creating them the first time the thread uses the recorder.
+ * 
+ * \return The histograms of the calling thread
+ */
+LatencyRecorder::ThreadHistograms* LatencyRecorder::GetThreadHistograms()
+{
+	// each thread remembers its histograms in every recorder it used
+	thread_local vector<pair<long long, ThreadHistograms*>> cache;
+
+	for (auto& entry : cache)
+	{
+		if (entry.first == id)
+			return entry.second;
+	}
+
+	// the histograms of destroyed recorders were freed with them, their entries only make the lookups longer
+	{
+		unique_lock<mutex> lock;
+		unordered_set<long long>& live = GetLiveRecorders(lock);
+		cache.erase(remove_if(cache.begin(), cache.end(), [&](const pair<long long, ThreadHistograms*>& entry)
+		{
+			return live.count(entry.first) == 0;
+		}), cache.end());
+	}
+
+	ThreadHistograms* histograms = new ThreadHistograms();
+	{
+		lock_guard<mutex> lock(threadsMutex);
+		threads.emplace_back(histograms);
+	}
+
+	cache.push_back(make_pair(id, histograms));
+	return histograms;
+}
+
+/**
+ * Decides whether the calling thread should time its next operation. Each recorder counts the operations
+ * of each thread on its own, so trees with different recorders don't shift each other's samples.
+ * 
+ * \return True if the operation should be timed
+ */
+bool LatencyRecorder::ShouldSample()
+{
+	return ++GetThreadHistograms()->operations % sampleEvery == 0;
+}
+
+/**
+ * Records the latency of an operation of the calling thread. Doesn't lock, only the calling thread writes its histograms.
+ * 
+ * \param type The type of the operation
+ * \param nanoseconds The latency of the operation
+ */
+void LatencyRecorder::Record(OperationType type, long long nanoseconds)
+{
+	if (type == OperationType::Other)
+		return;
+
+	atomic<long long>& bucket = GetThreadHistograms()->counts[(int)type][LatencyHistogram::BucketIndex(nanoseconds)];
+	bucket.store(bucket.load(memory_order_relaxed) + 1, memory_order_relaxed);
+}
+
+/**
+ * Merges the histograms of all threads for one operation type.
+ * 
+ * \param type The type of the operation
+ * \return The merged histogram, each latency counted at the upper bound of its bucket
+ */
+LatencyHistogram LatencyRecorder::GetHistogram(OperationType type)
+{
+	LatencyHistogram histogram;
+
+	if (type == OperationType::Other)
+		return histogram;
+
+	lock_guard<mutex> lock(threadsMutex);
+
+	for (auto& thread : threads)
+	{
+		for (int i = 0; i < LatencyHistogram::bucketCount; i++)
+		{
+			long long count = thread->counts[(int)type][i].load(memory_order_relaxed);
+			if (count > 0)
+				histogram.Record(LatencyHistogram::BucketUpperBound(i), count);
+		}
+	}
+
+	return histogram;
+}
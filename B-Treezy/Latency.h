@@ -0,0 +1,136 @@
+/*****************************************************************//**
+ * \file   Latency.h
+ * \brief  Latency recording and trace events of the tree operations
+ * 
+ * \author Kkobari
+ * \date   November 2022
+ *********************************************************************/
+
+#pragma once
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+
+using namespace std;
+
+/**
+ * \brief The tree operations whose latency is recorded.
+ */
+enum class OperationType
+{
+	Insert,
+	Find,
+	Remove,
+	/** Anything else, like a bulk load or a split of the tree - not recorded */
+	Other
+};
+
+/** The number of operation types with recorded latency */
+const int recordedOperationTypes = 3;
+
+/**
+ * \brief The kinds of structural changes reported by the trace hook.
+ */
+enum class TraceEventType
+{
+	Split,
+	RootGrow,
+	RootShrink,
+	BorrowLeft,
+	BorrowRight,
+	Merge,
+	/** A sampled operation finished, the event carries its latency */
+	Operation
+};
+
+/**
+ * \brief A structural change or a finished operation, reported to the trace callback of a tree.
+ */
+struct TraceEvent
+{
+	/** What happened */
+	TraceEventType type;
+	/** The operation during which it happened */
+	OperationType operation;
+	/** The sequence number of that operation in the tree, events of one operation share it */
+	long long operationId;
+	/** The number of values in the affected node after the change */
+	int nodeSize;
+	/** The latency of the operation in nanoseconds, only for Operation events */
+	long long latency;
+};
+
+/**
+ * \brief A histogram of latencies with logarithmic buckets. Each power of two is split into
+ * 16 buckets, so any recorded value is known within about 6 %.
+ */
+class LatencyHistogram
+{
+public:
+	/** The number of buckets each power of two is split into, as a power of two */
+	static const int subBucketBits = 4;
+	/** The number of buckets covering all non-negative 64-bit values */
+	static const int bucketCount = 64 << subBucketBits;
+
+	static int BucketIndex(long long value);
+	static long long BucketUpperBound(int index);
+
+	LatencyHistogram();
+
+	void Record(long long value, long long count = 1);
+	void Merge(const LatencyHistogram& other);
+
+	long long GetCount();
+	long long GetMax();
+	long long GetPercentile(double percentile);
+
+private:
+	/** The number of values in each bucket */
+	vector<long long> counts;
+	/** The number of recorded values */
+	long long count = 0;
+	/** The highest recorded value */
+	long long max = 0;
+};
+
+/**
+ * \brief Records sampled operation latencies. Every thread writes into its own histograms without locking,
+ * they are merged only when read.
+ */
+class LatencyRecorder
+{
+private:
+	/**
+	 * \brief The histograms written by one thread.
+	 */
+	struct ThreadHistograms
+	{
+		/** The bucket counts of each operation type, only ever written by the owning thread */
+		atomic<long long> counts[recordedOperationTypes][LatencyHistogram::bucketCount];
+		/** The operations the owning thread asked about sampling, counted for this recorder alone */
+		unsigned operations = 0;
+
+		ThreadHistograms();
+	};
+
+	/** Identifies the recorder in the per-thread caches, addresses could be reused */
+	long long id;
+	/** Every how many operations one is sampled */
+	int sampleEvery;
+	/** The histograms of all threads which recorded so far */
+	vector<unique_ptr<ThreadHistograms>> threads;
+	/** Guards the list of threads */
+	mutex threadsMutex;
+
+	ThreadHistograms* GetThreadHistograms();
+
+public:
+	LatencyRecorder(int sampleEvery = 16);
+	~LatencyRecorder();
+
+	bool ShouldSample();
+	void Record(OperationType type, long long nanoseconds);
+
+	LatencyHistogram GetHistogram(OperationType type);
+};
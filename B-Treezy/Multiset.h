@@ -0,0 +1,186 @@
+/*****************************************************************//**
+ * \file   Multiset.h
+ * \brief  Values which let the tree keep repeated keys only once
+ *
+ * \author Kkobari
+ * \date   November 2022
+ *********************************************************************/
+
+#pragma once
+#include <iostream>
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+/*
+ * The multiset traits tell the tree what to do with a value equal to one already stored. They provide:
+ *   enabled                      - whether equal values are merged instead of rejected
+ *   Multiplicity(value)          - how many times the value counts
+ *   Repeat(value, times)         - the value counted that many times
+ *   Add(stored, added)           - merges an equal value into the stored one
+ *   Subtract(stored, removed)    - takes an equal value out of the stored one, returns whether anything is left of it
+ *   Intersect(stored, other)     - keeps only what the stored value shares with an equal value, returns whether anything is left of it
+ *
+ * The set operations of the tree follow the traits, so a union adds up the counts of the keys in both trees,
+ * an intersection keeps the lower of the two counts and a difference subtracts the counts of the second tree.
+ */
+
+/**
+ * \brief The default traits, every value is stored at most once.
+ */
+template <class T>
+struct MultisetTraits
+{
+	static constexpr bool enabled = false;
+
+	static long long Multiplicity(const T& value) { return 1; }
+	static T Repeat(const T& value, long long times) { return value; }
+	static void Add(T& stored, const T& added) {}
+	static bool Subtract(T& stored, const T& removed) { return false; }
+	static bool Intersect(T& stored, const T& other) { return true; }
+};
+
+/**
+ * \brief A key with the number of times it was inserted. Only the key is compared,
+ * so a key repeated any number of times takes a single slot in the tree.
+ */
+template <class K>
+struct Counted
+{
+	/** The key */
+	K key;
+	/** The number of times the key is present */
+	long long count;
+
+	Counted() : key(), count(1) {}
+	Counted(const K& key, long long count = 1) : key(key), count(count) {}
+};
+
+template <class K>
+bool operator<(const Counted<K>& left, const Counted<K>& right) { return left.key < right.key; }
+
+template <class K>
+bool operator==(const Counted<K>& left, const Counted<K>& right) { return left.key == right.key; }
+
+template <class K>
+ostream& operator<<(ostream& stream, const Counted<K>& value)
+{
+	stream << value.key;
+	if (value.count != 1)
+		stream << "x" << value.count;
+	return stream;
+}
+
+/**
+ * \brief The traits of counted keys, the counts are added up and removes decrement them.
+ */
+template <class K>
+struct MultisetTraits<Counted<K>>
+{
+	static constexpr bool enabled = true;
+
+	static long long Multiplicity(const Counted<K>& value) { return value.count; }
+	static Counted<K> Repeat(const Counted<K>& value, long long times) { return Counted<K>(value.key, value.count * times); }
+	static void Add(Counted<K>& stored, const Counted<K>& added) { stored.count += added.count; }
+
+	static bool Subtract(Counted<K>& stored, const Counted<K>& removed)
+	{
+		stored.count -= removed.count;
+		return stored.count > 0;
+	}
+
+	static bool Intersect(Counted<K>& stored, const Counted<K>& other)
+	{
+		stored.count = min(stored.count, other.count);
+		return stored.count > 0;
+	}
+};
+
+/**
+ * \brief A key with the payloads inserted under it, kept in one list. Only the key is compared,
+ * so all payloads of a key take a single slot in the tree.
+ */
+template <class K, class P>
+struct Posting
+{
+	/** The key */
+	K key;
+	/** The payloads inserted under the key, in the order of insertion */
+	vector<P> payloads;
+
+	Posting() : key() {}
+	Posting(const K& key) : key(key) {}
+	Posting(const K& key, const P& payload) : key(key), payloads(1, payload) {}
+};
+
+template <class K, class P>
+bool operator<(const Posting<K, P>& left, const Posting<K, P>& right) { return left.key < right.key; }
+
+template <class K, class P>
+bool operator==(const Posting<K, P>& left, const Posting<K, P>& right) { return left.key == right.key; }
+
+template <class K, class P>
+ostream& operator<<(ostream& stream, const Posting<K, P>& value)
+{
+	return stream << value.key << "[" << value.payloads.size() << "]";
+}
+
+/**
+ * \brief The traits of posting lists, the payloads are appended and removes take out the given payloads,
+ * or the last one if none is given. Intersections keep the payloads found in both lists.
+ */
+template <class K, class P>
+struct MultisetTraits<Posting<K, P>>
+{
+	static constexpr bool enabled = true;
+
+	static long long Multiplicity(const Posting<K, P>& value) { return value.payloads.size(); }
+
+	static Posting<K, P> Repeat(const Posting<K, P>& value, long long times)
+	{
+		Posting<K, P> repeated(value.key);
+		for (long long i = 0; i < times; i++)
+			repeated.payloads.insert(repeated.payloads.end(), value.payloads.begin(), value.payloads.end());
+		return repeated;
+	}
+
+	static void Add(Posting<K, P>& stored, const Posting<K, P>& added)
+	{
+		stored.payloads.insert(stored.payloads.end(), added.payloads.begin(), added.payloads.end());
+	}
+
+	static bool Subtract(Posting<K, P>& stored, const Posting<K, P>& removed)
+	{
+		if (removed.payloads.empty() && !stored.payloads.empty())
+			stored.payloads.pop_back();
+
+		for (auto& payload : removed.payloads)
+		{
+			auto found = find(stored.payloads.begin(), stored.payloads.end(), payload);
+			if (found != stored.payloads.end())
+				stored.payloads.erase(found);
+		}
+
+		return !stored.payloads.empty();
+	}
+
+	static bool Intersect(Posting<K, P>& stored, const Posting<K, P>& other)
+	{
+		// every payload of the other list matches at most one payload of the stored list
+		vector<P> unmatched = other.payloads;
+		vector<P> kept;
+		for (auto& payload : stored.payloads)
+		{
+			auto found = find(unmatched.begin(), unmatched.end(), payload);
+			if (found != unmatched.end())
+			{
+				kept.push_back(payload);
+				unmatched.erase(found);
+			}
+		}
+
+		stored.payloads = move(kept);
+		return !stored.payloads.empty();
+	}
+};
@@ -0,0 +1,154 @@
+/*****************************************************************//**
+ * \file   NodeArena.cpp
+ * \brief  Blocks of memory nodes are packed into when the tree is defragmented
+ * 
+ * \author Kkobari
+ * \date   November 2022
+ *********************************************************************/
+
+#include "NodeArena.h"
+#include <new>
+
+/**
+ * Allocates a node on its own.
+ * 
+ * \param size The size of the node
+ * \return The memory for the node
+ */
+void* NodeArena::AllocateSingle(size_t size)
+{
+	char* block = (char*)::operator new(prefixSize + size);
+	*(NodeArena**)block = nullptr;
+
+	return block + prefixSize;
+}
+
+/**
+ * Frees the memory of a node, either on its own or in an arena.
+ * 
+ * \param pointer The memory of the node
+ */
+void NodeArena::Free(void* pointer)
+{
+	if (pointer == nullptr)
+		return;
+
+	NodeArena* arena = GetArena(pointer);
+	if (arena == nullptr)
+		::operator delete((char*)pointer - prefixSize);
+	else
+		arena->Release();
+}
+
+/**
+ * Gets the arena a node lives in.
+ * 
+ * \param pointer The memory of the node
+ * \return The arena, nullptr if the node was allocated on its own
+ */
+NodeArena* NodeArena::GetArena(const void* pointer)
+{
+	return *(NodeArena* const*)((const char*)pointer - prefixSize);
+}
+
+/**
+ * Constructs the arena.
+ * 
+ * \param nodeSize The size of the nodes
+ * \param capacity The number of nodes it can hold
+ */
+NodeArena::NodeArena(size_t nodeSize, int capacity)
+{
+	// keeps every slot aligned like the first one
+	this->slotSize = (prefixSize + nodeSize + prefixSize - 1) / prefixSize * prefixSize;
+	this->capacity = capacity < 1 ? 1 : capacity;
+	this->memory = (char*)::operator new(slotSize * this->capacity);
+}
+
+/**
+ * Frees the slots.
+ */
+NodeArena::~NodeArena()
+{
+	::operator delete(memory);
+}
+
+/**
+ * Hands out the next slot.
+ * 
+ * \param size The size of the node, must fit the slots
+ * \return The memory for the node
+ */
+void* NodeArena::Allocate(size_t size)
+{
+	if (sealed || used == capacity || prefixSize + size > slotSize)
+		throw std::bad_alloc();
+
+	char* slot = memory + slotSize * used++;
+	*(NodeArena**)slot = this;
+	live++;
+
+	return slot + prefixSize;
+}
+
+/**
+ * Checks whether all slots were handed out.
+ * 
+ * \return True if the arena is full
+ */
+bool NodeArena::IsFull()
+{
+	return used == capacity;
+}
+
+/**
+ * Stops handing out slots, the arena is freed with its last node from now on.
+ */
+void NodeArena::Seal()
+{
+	sealed = true;
+
+	if (live == 0)
+		delete this;
+}
+
+/**
+ * Notes that a node in the arena was deleted.
+ */
+void NodeArena::Release()
+{
+	live--;
+
+	if (sealed && live == 0)
+		delete this;
+}
+
+/**
+ * Gets the size of a slot.
+ * 
+ * \return The size of a slot, including the prefix
+ */
+size_t NodeArena::GetSlotSize()
+{
+	return slotSize;
+}
+
+/**
+ * Gets the number of slots.
+ * 
+ * \return The number of slots
+ */
+int NodeArena::GetCapacity()
+{
+	return capacity;
+}
+
+/**
+ * Gets the number of nodes still living in the arena.
+ * 
+ * \return The number of nodes
+ */
+int NodeArena::GetLiveCount()
+{
+	return live;
+}
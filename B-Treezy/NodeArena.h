@@ -0,0 +1,103 @@
+/*****************************************************************//**
+ * \file   NodeArena.h
+ * \brief  Blocks of memory nodes are packed into when the tree is defragmented
+ * 
+ * Every node is allocated with a small prefix pointing to the arena it lives in,
+ * or nullptr for nodes allocated on their own, so deleting a node works the same either way.
+ * 
+ * \author Kkobari
+ * \date   November 2022
+ *********************************************************************/
+
+#pragma once
+#include <cstddef>
+
+/**
+ * \brief A block of equally sized slots filled one after another. A slot isn't reused once its node is
+ * deleted, the block is freed with its last node after it was sealed.
+ */
+class NodeArena
+{
+private:
+	/** The slots */
+	char* memory;
+	/** The size of a slot, including the prefix */
+	size_t slotSize;
+	/** The number of slots */
+	int capacity;
+	/** The number of slots handed out */
+	int used = 0;
+	/** The number of nodes still living in the slots */
+	int live = 0;
+	/** Whether no more slots will be handed out */
+	bool sealed = false;
+
+	void Release();
+
+public:
+	/** The size of the prefix before every node, keeps the node aligned */
+	static const size_t prefixSize = alignof(max_align_t) > sizeof(void*) ? alignof(max_align_t) : sizeof(void*);
+
+	static void* AllocateSingle(size_t size);
+	static void Free(void* pointer);
+	static NodeArena* GetArena(const void* pointer);
+
+	NodeArena(size_t nodeSize, int capacity);
+	~NodeArena();
+
+	void* Allocate(size_t size);
+	bool IsFull();
+	void Seal();
+
+	size_t GetSlotSize();
+	int GetCapacity();
+	int GetLiveCount();
+};
+
+/**
+ * \brief The orders Defragment can lay the nodes out in.
+ */
+enum class DefragmentOrder
+{
+	/** Level by level from the root, each level from left to right */
+	BreadthFirst,
+	/** The upper half of the levels first, then each subtree below it, both laid out the same way recursively */
+	VanEmdeBoas
+};
+
+/**
+ * \brief The memory held by a tree, in bytes.
+ */
+struct TreeMemoryUsage
+{
+	/** The node objects themselves, with their allocation prefix or arena slot */
+	size_t nodeHeaders = 0;
+	/** The values in use, with what they hold on the heap (like long strings) */
+	size_t keyStorage = 0;
+	/** The child pointers in use */
+	size_t childArrays = 0;
+	/** The capacity reserved but unused by the values and children, and the arena slots of deleted nodes */
+	size_t slack = 0;
+	/** The compressed blocks of cold subtrees */
+	size_t coldBlocks = 0;
+
+	/**
+	 * Gets the memory held by the nodes, without the cold blocks.
+	 * 
+	 * \return The sum of all parts but the cold blocks
+	 */
+	size_t Hot() const
+	{
+		return nodeHeaders + keyStorage + childArrays + slack;
+	}
+
+	/**
+	 * Gets the memory held in total.
+	 * 
+	 * \return The sum of all parts
+	 */
+	size_t Total() const
+	{
+		return Hot() + coldBlocks;
+	}
+};
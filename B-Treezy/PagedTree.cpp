@@ -0,0 +1,522 @@
+/*****************************************************************//**
+ * \file   PagedTree.cpp
+ * \brief  A read-only snapshot of a tree in a file of fixed-size pages
+ * 
+ * \author Kkobari
+ * \date   November 2022
+ *********************************************************************/
+
+#include "PagedTree.h"
+#include "Multiset.h"
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+
+/** The first bytes of every page file */
+static const char pageFileMagic[4] = { 'B', 'T', 'P', 'G' };
+/** The version of the format */
+static const uint32_t pageFileVersion = 1;
+
+/**
+ * Gets the values of a page.
+ * 
+ * \param page The page
+ * \return The values
+ */
+template <class T>
+const T* PagedTree<T>::GetValues(const char* page)
+{
+	return (const T*)(page + sizeof(PageHeader));
+}
+
+/**
+ * Gets the child page numbers of an internal page.
+ * 
+ * \param page The page
+ * \return The child page numbers
+ */
+template <class T>
+const uint32_t* PagedTree<T>::GetChildren(const char* page)
+{
+	return (const uint32_t*)(page + sizeof(PageHeader) + ((const PageHeader*)page)->count * sizeof(T));
+}
+
+/**
+ * Writes sorted values into a page file.
+ * 
+ * \param path The path of the file, it is overwritten
+ * \param values The values, sorted and without duplicates
+ * \param pageSize The size of every page
+ * \return False if the file couldn't be written or the values can't be stored in pages
+ */
+template <class T>
+bool PagedTree<T>::Write(const string& path, const vector<T>& values, int pageSize)
+{
+	int leafCapacity = (pageSize - (int)sizeof(PageHeader)) / (int)sizeof(T);
+	int internalCapacity = (pageSize - (int)sizeof(PageHeader) - (int)sizeof(uint32_t)) / (int)(sizeof(T) + sizeof(uint32_t));
+	if (internalCapacity < 2 || pageSize < (int)sizeof(PageFileHeader) || leafCapacity > UINT16_MAX)
+	{
+		cout << "pages of " << pageSize << " bytes can't hold " << sizeof(T) << " byte values" << endl;
+		return false;
+	}
+
+	ofstream file(path, ios::binary | ios::trunc);
+	if (!file)
+	{
+		cout << "can't open " << path << " for writing" << endl;
+		return false;
+	}
+
+	vector<char> page(pageSize);
+	PageHeader* pageHeader = (PageHeader*)page.data();
+
+	// the header page is written last, once the root is known
+	file.write(page.data(), pageSize);
+
+	// the leaves, one after another from page 1
+	vector<T> firsts;
+	vector<uint32_t> numbers;
+	uint32_t next = 1;
+
+	for (size_t i = 0; i < values.size(); i += leafCapacity)
+	{
+		int count = min<size_t>(leafCapacity, values.size() - i);
+
+		fill(page.begin(), page.end(), 0);
+		pageHeader->count = count;
+		pageHeader->leaf = 1;
+		memcpy(page.data() + sizeof(PageHeader), &values[i], count * sizeof(T));
+		file.write(page.data(), pageSize);
+
+		firsts.push_back(values[i]);
+		numbers.push_back(next++);
+	}
+
+	PageFileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, pageFileMagic, sizeof(pageFileMagic));
+	header.version = pageFileVersion;
+	header.pageSize = pageSize;
+	header.valueSize = sizeof(T);
+	header.leafCount = numbers.size();
+	header.height = numbers.empty() ? 0 : 1;
+	header.valueCount = values.size();
+
+	// the internal levels, each page gets an even share of the pages below so none is left with a single child
+	while (numbers.size() > 1)
+	{
+		size_t groups = (numbers.size() + internalCapacity) / (internalCapacity + 1);
+		vector<T> upperFirsts;
+		vector<uint32_t> upperNumbers;
+
+		size_t start = 0;
+		for (size_t group = 0; group < groups; group++)
+		{
+			size_t end = start + numbers.size() / groups + (group < numbers.size() % groups ? 1 : 0);
+			int count = end - start - 1;
+
+			fill(page.begin(), page.end(), 0);
+			pageHeader->count = count;
+			pageHeader->leaf = 0;
+			memcpy(page.data() + sizeof(PageHeader), &firsts[start + 1], count * sizeof(T));
+			memcpy(page.data() + sizeof(PageHeader) + count * sizeof(T), &numbers[start], (count + 1) * sizeof(uint32_t));
+			file.write(page.data(), pageSize);
+
+			upperFirsts.push_back(firsts[start]);
+			upperNumbers.push_back(next++);
+			start = end;
+		}
+
+		firsts = move(upperFirsts);
+		numbers = move(upperNumbers);
+		header.height++;
+	}
+
+	header.rootPage = numbers.empty() ? 0 : numbers[0];
+
+	fill(page.begin(), page.end(), 0);
+	memcpy(page.data(), &header, sizeof(header));
+	file.seekp(0);
+	file.write(page.data(), pageSize);
+
+	return file.good();
+}
+
+/**
+ * Opens a page file and reads its header and root page.
+ * 
+ * \param path The path of the file
+ * \param queueDepth The most reads in flight at once
+ * \param useUring Whether to read through io_uring where available, otherwise on a thread pool
+ * \return False if the file can't be opened or isn't a page file of these values
+ */
+template <class T>
+bool PagedTree<T>::Open(const string& path, int queueDepth, bool useUring)
+{
+	ifstream file(path, ios::binary);
+	if (!file || !file.read((char*)&header, sizeof(header)))
+		return false;
+
+	if (memcmp(header.magic, pageFileMagic, sizeof(pageFileMagic)) != 0 || header.version != pageFileVersion || header.valueSize != sizeof(T))
+		return false;
+
+	if (header.rootPage != 0)
+	{
+		root.resize(header.pageSize);
+		file.seekg((long long)header.rootPage * header.pageSize);
+		if (!file.read(root.data(), header.pageSize))
+			return false;
+	}
+
+	reader = AsyncReader::Open(path, queueDepth, useUring);
+	return reader != nullptr;
+}
+
+/**
+ * Takes a page buffer, allocating a new one if none is free.
+ * 
+ * \return The buffer
+ */
+template <class T>
+char* PagedTree<T>::TakePage()
+{
+	if (freePages.empty())
+	{
+		pages.emplace_back(new char[header.pageSize]);
+		return pages.back().get();
+	}
+
+	char* page = freePages.back();
+	freePages.pop_back();
+	return page;
+}
+
+/**
+ * Gives a page buffer back for reuse.
+ * 
+ * \param page The buffer
+ */
+template <class T>
+void PagedTree<T>::ReturnPage(char* page)
+{
+	freePages.push_back(page);
+}
+
+/**
+ * Reads a page asynchronously.
+ * 
+ * \param number The number of the page
+ * \param page The buffer to read to
+ * \param done Called with whether the page was read
+ */
+template <class T>
+void PagedTree<T>::ReadPage(uint32_t number, char* page, const function<void(bool)>& done)
+{
+	reader->Submit((long long)number * header.pageSize, header.pageSize, page, done);
+}
+
+/**
+ * Picks the child of an internal page to go down to and reads it, or reports it if it is a leaf.
+ * 
+ * \param descent The descent
+ * \param page The internal page
+ */
+template <class T>
+void PagedTree<T>::Descend(Descent* descent, const char* page)
+{
+	const T* values = GetValues(page);
+	int count = ((const PageHeader*)page)->count;
+	uint32_t child = GetChildren(page)[upper_bound(values, values + count, descent->key) - values];
+
+	if (descent->levelsLeft == 2)
+	{
+		function<void(uint32_t)> leafFound = move(descent->leafFound);
+		ReturnPage(descent->page);
+		delete descent;
+
+		leafFound(child);
+		return;
+	}
+
+	descent->levelsLeft--;
+	ReadPage(child, descent->page, [this, descent](bool read)
+	{
+		if (read)
+		{
+			Descend(descent, descent->page);
+			return;
+		}
+
+		function<void(uint32_t)> leafFound = move(descent->leafFound);
+		ReturnPage(descent->page);
+		delete descent;
+
+		leafFound(0);
+	});
+}
+
+/**
+ * Finds the leaf page where a key belongs, reading the internal pages on the way.
+ * 
+ * \param key The key
+ * \param leafFound Called with the number of the leaf page, 0 if a read failed
+ */
+template <class T>
+void PagedTree<T>::Locate(const T& key, const function<void(uint32_t)>& leafFound)
+{
+	if (header.height == 1)
+	{
+		leafFound(header.rootPage);
+		return;
+	}
+
+	Descent* descent = new Descent{ key, header.height, TakePage(), leafFound };
+	Descend(descent, root.data());
+}
+
+/**
+ * Looks up a value. Many lookups can be in flight at once, each reading one page per level below the root.
+ * 
+ * \param key The value to look for
+ * \param done Called with true if the value is present, false if it isn't or a read failed
+ */
+template <class T>
+void PagedTree<T>::FindAsync(const T& key, const function<void(bool)>& done)
+{
+	if (header.valueCount == 0)
+	{
+		done(false);
+		return;
+	}
+
+	Locate(key, [this, key, done](uint32_t leaf)
+	{
+		if (leaf == 0)
+		{
+			done(false);
+			return;
+		}
+
+		if (leaf == header.rootPage)
+		{
+			const T* values = GetValues(root.data());
+			done(binary_search(values, values + ((const PageHeader*)root.data())->count, key));
+			return;
+		}
+
+		char* page = TakePage();
+		ReadPage(leaf, page, [this, key, done, page](bool read)
+		{
+			const T* values = GetValues(page);
+			bool found = read && binary_search(values, values + ((const PageHeader*)page)->count, key);
+
+			ReturnPage(page);
+			done(found);
+		});
+	});
+}
+
+/**
+ * Reads the next leaf pages of a scan, keeping up to its read ahead in flight or waiting.
+ * 
+ * \param scan The scan
+ */
+template <class T>
+void PagedTree<T>::ReadAhead(Scan* scan)
+{
+	uint32_t end = 1 + header.leafCount;
+
+	while (!scan->stopped && scan->nextRead < end && scan->nextRead < scan->nextDeliver + scan->readAhead)
+	{
+		uint32_t number = scan->nextRead++;
+		char* page = TakePage();
+
+		scan->ready.push_back(page);
+		scan->readDone.push_back(false);
+		scan->inFlight++;
+
+		ReadPage(number, page, [this, scan, number](bool read)
+		{
+			scan->inFlight--;
+
+			if (!read)
+				scan->stopped = scan->failed = true;
+			else if (!scan->stopped)
+				scan->readDone[number - scan->nextDeliver] = true;
+
+			Deliver(scan);
+		});
+	}
+}
+
+/**
+ * Hands the values of the leaf pages read so far over, in order, and finishes the scan at the end of its range.
+ * 
+ * \param scan The scan
+ */
+template <class T>
+void PagedTree<T>::Deliver(Scan* scan)
+{
+	while (!scan->stopped && !scan->readDone.empty() && scan->readDone.front())
+	{
+		char* page = scan->ready.front();
+		const T* values = GetValues(page);
+		int count = ((const PageHeader*)page)->count;
+
+		for (int i = 0; i < count; i++)
+		{
+			if (values[i] < scan->lo)
+				continue;
+
+			if (scan->hi < values[i])
+			{
+				scan->stopped = true;
+				break;
+			}
+
+			scan->onValue(values[i]);
+		}
+
+		ReturnPage(page);
+		scan->ready.pop_front();
+		scan->readDone.pop_front();
+		scan->nextDeliver++;
+	}
+
+	if (scan->nextDeliver == 1 + header.leafCount)
+		scan->stopped = true;
+
+	if (!scan->stopped)
+	{
+		ReadAhead(scan);
+		return;
+	}
+
+	// the pages still being read are left to finish before the scan goes away
+	if (scan->inFlight > 0)
+		return;
+
+	for (auto page : scan->ready)
+		ReturnPage(page);
+
+	function<void(bool)> done = move(scan->done);
+	bool succeeded = !scan->failed;
+	delete scan;
+
+	done(succeeded);
+}
+
+/**
+ * Calls a callback for every value within a range, in ascending order, reading the next leaf pages ahead.
+ * 
+ * \param lo The lowest value of the range
+ * \param hi The highest value of the range
+ * \param readAhead The most leaf pages read at once
+ * \param onValue The callback to call for each value
+ * \param done Called at the end with false if a read failed
+ */
+template <class T>
+void PagedTree<T>::ScanAsync(const T& lo, const T& hi, int readAhead, const function<void(const T&)>& onValue, const function<void(bool)>& done)
+{
+	if (header.valueCount == 0 || hi < lo)
+	{
+		done(true);
+		return;
+	}
+
+	Locate(lo, [this, lo, hi, readAhead, onValue, done](uint32_t leaf)
+	{
+		if (leaf == 0)
+		{
+			done(false);
+			return;
+		}
+
+		Scan* scan = new Scan();
+		scan->lo = lo;
+		scan->hi = hi;
+		scan->readAhead = readAhead < 1 ? 1 : readAhead;
+		scan->nextRead = scan->nextDeliver = leaf;
+		scan->onValue = onValue;
+		scan->done = done;
+
+		ReadAhead(scan);
+	});
+}
+
+/**
+ * Looks up a value and waits for the result.
+ * 
+ * \param key The value to look for
+ * \return True if the value is present
+ */
+template <class T>
+bool PagedTree<T>::Find(const T& key)
+{
+	bool found = false;
+	FindAsync(key, [&found](bool result) { found = result; });
+	Run();
+
+	return found;
+}
+
+/**
+ * Calls the callbacks of the completed reads.
+ * 
+ * \param wait Whether to wait for at least one read to complete
+ * \return The number of completed reads
+ */
+template <class T>
+int PagedTree<T>::Poll(bool wait)
+{
+	return reader->Poll(wait);
+}
+
+/**
+ * Completes all lookups and scans in flight, including the ones started by the callbacks.
+ */
+template <class T>
+void PagedTree<T>::Run()
+{
+	reader->Run();
+}
+
+/**
+ * Gets the name of the backend the pages are read through.
+ * 
+ * \return "io_uring" or "threads"
+ */
+template <class T>
+const char* PagedTree<T>::GetBackendName()
+{
+	return reader->GetName();
+}
+
+/**
+ * Gets the number of pages read so far.
+ * 
+ * \return The number of pages
+ */
+template <class T>
+long long PagedTree<T>::GetPageReads()
+{
+	return reader->GetCompletedCount();
+}
+
+/**
+ * Gets the number of values in the file.
+ * 
+ * \return The number of values
+ */
+template <class T>
+long long PagedTree<T>::GetValueCount()
+{
+	return header.valueCount;
+}
+
+// the member functions are defined here and not in the header, so the trees used elsewhere are instantiated here
+template class PagedTree<int>;
+template class PagedTree<long long>;
+template class PagedTree<Counted<int>>;
+template class PagedTree<Counted<long long>>;
@@ -0,0 +1,172 @@
+/*****************************************************************//**
+ * \file   PagedTree.h
+ * \brief  A read-only snapshot of a tree in a file of fixed-size pages, searched with asynchronous reads
+ * 
+ * Page 0 holds the header. The values are packed in sorted order into the leaf pages, which follow
+ * one after another from page 1, so a range scan can read the next leaves ahead. Each level of internal
+ * pages above them holds the first value of every page but the first below it, up to the single root page.
+ * 
+ * \author Kkobari
+ * \date   November 2022
+ *********************************************************************/
+
+#pragma once
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <type_traits>
+#include "AsyncIO.h"
+
+using namespace std;
+
+/**
+ * \brief The first page of a page file.
+ */
+struct PageFileHeader
+{
+	/** "BTPG" */
+	char magic[4];
+	/** The version of the format */
+	uint32_t version;
+	/** The size of every page */
+	uint32_t pageSize;
+	/** The size of a value */
+	uint32_t valueSize;
+	/** The page of the root, 0 if there are no values */
+	uint32_t rootPage;
+	/** The number of levels */
+	uint32_t height;
+	/** The number of leaf pages, they start at page 1 */
+	uint32_t leafCount;
+	/** The number of values */
+	uint64_t valueCount;
+};
+
+/**
+ * \brief The start of every page but the header.
+ */
+struct PageHeader
+{
+	/** The number of values in the page */
+	uint16_t count;
+	/** Whether the page is a leaf, otherwise count + 1 child page numbers follow the values */
+	uint16_t leaf;
+	uint32_t reserved;
+};
+
+/**
+ * \brief Finds and scans values stored in a page file. Only the root page is kept in memory, every other
+ * page is read when needed, with many lookups and scans in flight at once. The callbacks are called
+ * from Poll and Run on the calling thread. The values must be trivially copyable.
+ */
+template <class T>
+class PagedTree
+{
+	static_assert(is_trivially_copyable<T>::value, "the values are copied into the pages byte by byte");
+
+private:
+	/**
+	 * \brief A lookup or scan going down the internal pages.
+	 */
+	struct Descent
+	{
+		/** The value looked for */
+		T key;
+		/** The number of levels from the page being read down to the leaves, including both */
+		uint32_t levelsLeft;
+		/** The page read into */
+		char* page;
+		/** Called with the leaf page holding the key, 0 if a read failed */
+		function<void(uint32_t)> leafFound;
+	};
+
+	/**
+	 * \brief A scan going over the leaf pages.
+	 */
+	struct Scan
+	{
+		T lo;
+		T hi;
+		/** The most leaf pages read ahead */
+		int readAhead;
+		/** The next leaf page to read */
+		uint32_t nextRead;
+		/** The next leaf page to hand its values over */
+		uint32_t nextDeliver;
+		/** The leaf pages read but not handed over yet, in the order of the pages */
+		deque<char*> ready;
+		/** Whether the read of each page in ready finished */
+		deque<bool> readDone;
+		/** The reads in flight */
+		int inFlight = 0;
+		/** Whether the end of the range was found or a read failed */
+		bool stopped = false;
+		/** Whether a read failed */
+		bool failed = false;
+		function<void(const T&)> onValue;
+		function<void(bool)> done;
+	};
+
+	/** The header of the file */
+	PageFileHeader header;
+	/** The root page, kept in memory */
+	vector<char> root;
+	/** Page buffers not used at the moment */
+	vector<char*> freePages;
+	/** All page buffers */
+	vector<unique_ptr<char[]>> pages;
+	/** The reader of the file, declared last so it is destroyed first and its reads in flight finish before the buffers go away */
+	unique_ptr<AsyncReader> reader;
+
+	char* TakePage();
+	void ReturnPage(char* page);
+	void ReadPage(uint32_t number, char* page, const function<void(bool)>& done);
+
+	void Descend(Descent* descent, const char* page);
+	void Locate(const T& key, const function<void(uint32_t)>& leafFound);
+	void ReadAhead(Scan* scan);
+	void Deliver(Scan* scan);
+
+	static const T* GetValues(const char* page);
+	static const uint32_t* GetChildren(const char* page);
+
+public:
+	static bool Write(const string& path, const vector<T>& values, int pageSize = 4096);
+
+	bool Open(const string& path, int queueDepth, bool useUring = true);
+
+	void FindAsync(const T& key, const function<void(bool)>& done);
+	void ScanAsync(const T& lo, const T& hi, int readAhead, const function<void(const T&)>& onValue, const function<void(bool)>& done);
+	bool Find(const T& key);
+
+	int Poll(bool wait);
+	void Run();
+
+	const char* GetBackendName();
+	long long GetPageReads();
+	long long GetValueCount();
+};
+
+/**
+ * Writes sorted values into a page file.
+ * 
+ * \param path The path of the file, it is overwritten
+ * \param values The values, sorted and without duplicates
+ * \param pageSize The size of every page
+ * \return False if the file couldn't be written
+ */
+template <class T>
+typename enable_if<is_trivially_copyable<T>::value, bool>::type WritePageFile(const string& path, const vector<T>& values, int pageSize)
+{
+	return PagedTree<T>::Write(path, values, pageSize);
+}
+
+// values owning memory elsewhere, like strings, can't be copied into pages
+template <class T>
+typename enable_if<!is_trivially_copyable<T>::value, bool>::type WritePageFile(const string& path, const vector<T>& values, int pageSize)
+{
+	cout << "only trivially copyable values can be written into pages" << endl;
+	return false;
+}
@@ -0,0 +1,434 @@
+/*****************************************************************//**
+ * \file   ShardedBTree.cpp
+ * \brief  A front end splitting the key space into ranges, each kept in its own tree, for concurrent writes
+ * 
+ * \author Kkobari
+ * \date   November 2022
+ *********************************************************************/
+
+#include "ShardedBTree.h"
+
+/**
+ * Creates an empty sharded tree. It starts as a single shard, which is split as the writes come in.
+ * 
+ * \param order The order of the trees
+ * \param maxShards The most shards there can be, about the number of writing threads
+ */
+template <class T>
+ShardedBTree<T>::ShardedBTree(int order, int maxShards)
+{
+	this->order = order;
+	this->maxShards = maxShards < 1 ? 1 : maxShards;
+	this->shards.emplace_back(new Shard(new BTree<T>(order)));
+}
+
+/**
+ * Deletes the trees of all shards.
+ */
+template <class T>
+ShardedBTree<T>::~ShardedBTree()
+{
+	for (auto& shard : shards)
+		delete shard->tree;
+}
+
+/**
+ * Finds the shard whose range holds a value. The boundaries have to be locked.
+ * 
+ * \param value The value
+ * \return The index of the shard
+ */
+template <class T>
+int ShardedBTree<T>::Route(const T& value)
+{
+	return upper_bound(boundaries.begin(), boundaries.end(), value) - boundaries.begin();
+}
+
+/**
+ * Counts a write into a shard and adds its value to the sample. The shard has to be locked.
+ * 
+ * \param shard The shard written to
+ * \param value The value written
+ * \return True if the shard got enough writes to rebalance
+ */
+template <class T>
+bool ShardedBTree<T>::NoteWrite(Shard& shard, const T& value)
+{
+	if (shard.recent.size() < recentCapacity)
+		shard.recent.push_back(value);
+	else
+		shard.recent[shard.recentCount % recentCapacity] = value;
+
+	shard.recentCount++;
+	shard.writes++;
+
+	return rebalanceInterval > 0 && shard.writes >= rebalanceInterval;
+}
+
+/**
+ * Inserts a value into the shard holding its range.
+ * 
+ * \param value The value to insert
+ */
+template <class T>
+void ShardedBTree<T>::Insert(T value)
+{
+	bool due;
+
+	{
+		shared_lock<shared_timed_mutex> routing(boundariesMutex);
+		Shard& shard = *shards[Route(value)];
+
+		lock_guard<mutex> guard(shard.lock);
+		shard.tree->Insert(value);
+		due = NoteWrite(shard, value);
+	}
+
+	if (due)
+		RebalanceIfDue();
+}
+
+/**
+ * Searches the shard holding the range of a value.
+ * 
+ * \param value The value to search for
+ * \return True if the value is present
+ */
+template <class T>
+bool ShardedBTree<T>::Find(T value)
+{
+	shared_lock<shared_timed_mutex> routing(boundariesMutex);
+	Shard& shard = *shards[Route(value)];
+
+	lock_guard<mutex> guard(shard.lock);
+	return shard.tree->Find(value);
+}
+
+/**
+ * Removes a value from the shard holding its range.
+ * 
+ * \param value The value to remove
+ */
+template <class T>
+void ShardedBTree<T>::Remove(T value)
+{
+	bool due;
+
+	{
+		shared_lock<shared_timed_mutex> routing(boundariesMutex);
+		Shard& shard = *shards[Route(value)];
+
+		lock_guard<mutex> guard(shard.lock);
+		shard.tree->Remove(value);
+		due = NoteWrite(shard, value);
+	}
+
+	if (due)
+		RebalanceIfDue();
+}
+
+/**
+ * Loads many values at once. A sharded tree still in a single shard is first cut into even shards by the values,
+ * then each shard loads the values of its range. Values already in the tree are kept and duplicates are dropped.
+ * 
+ * \param values The values to load
+ */
+template <class T>
+void ShardedBTree<T>::BulkLoad(vector<T> values)
+{
+	unique_lock<shared_timed_mutex> exclusive(boundariesMutex);
+
+	if (values.empty())
+		return;
+
+	sort(values.begin(), values.end());
+
+	if (shards.size() == 1)
+	{
+		for (int i = 1; i < maxShards; i++)
+		{
+			const T& cut = values[values.size() * i / maxShards];
+
+			// equal values stay in one shard
+			if ((boundaries.empty() ? values.front() : boundaries.back()) < cut)
+			{
+				shards.emplace_back(new Shard(shards.back()->tree->Split(cut)));
+				boundaries.push_back(cut);
+			}
+		}
+	}
+
+	size_t start = 0;
+	for (size_t i = 0; i < shards.size(); i++)
+	{
+		size_t end = i < boundaries.size() ? lower_bound(values.begin() + start, values.end(), boundaries[i]) - values.begin() : values.size();
+
+		if (end > start)
+			shards[i]->tree->BulkLoad(vector<T>(values.begin() + start, values.begin() + end));
+
+		start = end;
+	}
+}
+
+/**
+ * Calls a callback for every value within a range, in ascending order. The shards are visited one after another,
+ * each locked only while it is scanned.
+ * 
+ * \param lo The lowest value of the range
+ * \param hi The highest value of the range
+ * \param callback The callback to call for each value
+ */
+template <class T>
+void ShardedBTree<T>::ForEachRange(T lo, T hi, const function<void(const T&)>& callback)
+{
+	shared_lock<shared_timed_mutex> routing(boundariesMutex);
+
+	for (int i = Route(lo); i < shards.size(); i++)
+	{
+		if (i > 0 && hi < boundaries[i - 1])
+			break;
+
+		lock_guard<mutex> guard(shards[i]->lock);
+		shards[i]->tree->ForEachRange(lo, hi, callback);
+	}
+}
+
+/**
+ * Rebalances the shards if a shard still got enough writes once the boundaries are locked,
+ * another writer could have rebalanced them in the meantime.
+ */
+template <class T>
+void ShardedBTree<T>::RebalanceIfDue()
+{
+	unique_lock<shared_timed_mutex> exclusive(boundariesMutex);
+
+	for (auto& shard : shards)
+	{
+		if (shard->writes >= rebalanceInterval)
+		{
+			InternalRebalance();
+			return;
+		}
+	}
+}
+
+/**
+ * Rebalances the shards by the writes they got since the last rebalance.
+ * 
+ * \return True if a shard was split
+ */
+template <class T>
+bool ShardedBTree<T>::Rebalance()
+{
+	unique_lock<shared_timed_mutex> exclusive(boundariesMutex);
+	return InternalRebalance();
+}
+
+/**
+ * Splits the shard with the most writes while there are fewer shards than allowed. With all shards in use,
+ * it is split only if it got many times more writes than the average, and the two neighbouring shards
+ * with the fewest writes are merged to make room. The boundaries have to be locked exclusively.
+ * 
+ * \return True if a shard was split
+ */
+template <class T>
+bool ShardedBTree<T>::InternalRebalance()
+{
+	long long total = 0;
+	int hottest = 0;
+
+	for (int i = 0; i < shards.size(); i++)
+	{
+		total += shards[i]->writes;
+		if (shards[i]->writes > shards[hottest]->writes)
+			hottest = i;
+	}
+
+	long long hottestWrites = shards[hottest]->writes;
+	bool split = false;
+
+	if (shards.size() < maxShards)
+	{
+		split = SplitShard(hottest);
+	}
+	else if (hottestWrites > skewFactor * total / shards.size())
+	{
+		// the coldest neighbours, away from the hottest shard
+		int coldest = -1;
+		for (int i = 0; i + 1 < shards.size(); i++)
+		{
+			if (i == hottest || i + 1 == hottest)
+				continue;
+
+			if (coldest < 0 || shards[i]->writes + shards[i + 1]->writes < shards[coldest]->writes + shards[coldest + 1]->writes)
+				coldest = i;
+		}
+
+		// merging only pays off if the merged shard gets fewer writes than each half of the split one
+		if (coldest >= 0 && 2 * (shards[coldest]->writes + shards[coldest + 1]->writes) < hottestWrites && SplitShard(hottest))
+		{
+			MergeShards(coldest < hottest ? coldest : coldest + 1);
+			split = true;
+		}
+	}
+
+	for (auto& shard : shards)
+		shard->writes = 0;
+
+	return split;
+}
+
+/**
+ * Splits a shard at the median of its sampled writes. The boundaries have to be locked exclusively.
+ * 
+ * \param index The index of the shard
+ * \return False if the sample has no median to split at, like when all writes went to a single value
+ */
+template <class T>
+bool ShardedBTree<T>::SplitShard(int index)
+{
+	Shard& shard = *shards[index];
+
+	vector<T> sample = shard.recent;
+	sort(sample.begin(), sample.end());
+
+	if (sample.size() < 2 || !(sample.front() < sample[sample.size() / 2]))
+		return false;
+
+	T median = sample[sample.size() / 2];
+
+	shards.emplace(shards.begin() + index + 1, new Shard(shard.tree->Split(median)));
+	boundaries.insert(boundaries.begin() + index, median);
+
+	shard.recent.clear();
+	shard.recentCount = 0;
+	rebalanceCount++;
+
+	return true;
+}
+
+/**
+ * Merges a shard with the next one. The boundaries have to be locked exclusively.
+ * 
+ * \param index The index of the first shard
+ */
+template <class T>
+void ShardedBTree<T>::MergeShards(int index)
+{
+	BTree<T>* left = shards[index]->tree;
+	BTree<T>* right = shards[index + 1]->tree;
+	T boundary = boundaries[index];
+
+	// the lowest value of the right shard (or the boundary, removed again) is the pivot between the trees
+	BTree<T>* joined;
+	const T* stored = right->Lookup(boundary);
+	if (stored != nullptr)
+	{
+		T pivot = *stored;
+		right->Remove(pivot);
+		joined = BTree<T>::Join(left, pivot, right);
+	}
+	else
+	{
+		joined = BTree<T>::Join(left, boundary, right);
+		joined->Remove(boundary);
+	}
+
+	delete left;
+	delete right;
+
+	shards[index]->tree = joined;
+	shards[index]->recent.clear();
+	shards[index]->recentCount = 0;
+	shards.erase(shards.begin() + index + 1);
+	boundaries.erase(boundaries.begin() + index);
+	rebalanceCount++;
+}
+
+/**
+ * Sets when the shards are rebalanced.
+ * 
+ * \param interval The number of writes into one shard after which the shards are rebalanced, 0 to rebalance only on request
+ * \param skewFactor How many times more writes than the average make a shard too hot
+ */
+template <class T>
+void ShardedBTree<T>::SetRebalancing(long long interval, double skewFactor)
+{
+	unique_lock<shared_timed_mutex> exclusive(boundariesMutex);
+
+	this->rebalanceInterval = interval;
+	this->skewFactor = skewFactor;
+}
+
+/**
+ * Packs the nodes of each shard into arenas of its own.
+ * 
+ * \param order The order to lay the nodes out in
+ */
+template <class T>
+void ShardedBTree<T>::Defragment(DefragmentOrder order)
+{
+	shared_lock<shared_timed_mutex> routing(boundariesMutex);
+
+	for (auto& shard : shards)
+	{
+		lock_guard<mutex> guard(shard->lock);
+		shard->tree->Defragment(order);
+	}
+}
+
+/**
+ * Gets the number of shards.
+ * 
+ * \return The number of shards
+ */
+template <class T>
+int ShardedBTree<T>::GetShardCount()
+{
+	shared_lock<shared_timed_mutex> routing(boundariesMutex);
+	return shards.size();
+}
+
+/**
+ * Gets the number of shard splits and merges done.
+ * 
+ * \return The number of splits and merges
+ */
+template <class T>
+long long ShardedBTree<T>::GetRebalanceCount()
+{
+	shared_lock<shared_timed_mutex> routing(boundariesMutex);
+	return rebalanceCount;
+}
+
+/**
+ * Prints the range, the writes and the memory of every shard.
+ */
+template <class T>
+void ShardedBTree<T>::PrintStats()
+{
+	unique_lock<shared_timed_mutex> exclusive(boundariesMutex);
+
+	cout << "Sharded tree stats:" << endl;
+	cout << "  Order: " << order << endl;
+	cout << "  Shards: " << shards.size() << " of " << maxShards << endl;
+	cout << "  Splits and merges: " << rebalanceCount << endl;
+
+	for (int i = 0; i < shards.size(); i++)
+	{
+		cout << "  Shard " << i << ": ";
+		if (i > 0)
+			cout << "from " << boundaries[i - 1] << " ";
+		if (i < boundaries.size())
+			cout << "below " << boundaries[i] << " ";
+		cout << "- " << shards[i]->writes << " writes, " << shards[i]->tree->MemoryUsage().Total() << " B" << endl;
+	}
+}
+
+// the member functions are defined here and not in the header, so the trees used elsewhere are instantiated here
+template class ShardedBTree<int>;
+template class ShardedBTree<long long>;
+template class ShardedBTree<string>;
+template class ShardedBTree<Counted<int>>;
+template class ShardedBTree<Counted<long long>>;
+template class ShardedBTree<Counted<string>>;
@@ -0,0 +1,95 @@
+/*****************************************************************//**
+ * \file   ShardedBTree.h
+ * \brief  A front end splitting the key space into ranges, each kept in its own tree, for concurrent writes
+ * 
+ * \author Kkobari
+ * \date   November 2022
+ *********************************************************************/
+
+#pragma once
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <functional>
+#include "BTree.h"
+
+using namespace std;
+
+/**
+ * \brief Keeps the values in several trees, each holding one range of the key space behind its own lock,
+ * so writers to different ranges don't wait for each other. Each tree owns its nodes, Defragment packs them
+ * into arenas of their own. The shards are split where the writes land and merged where they don't,
+ * so the writes stay spread evenly even when they are skewed.
+ */
+template <class T>
+class ShardedBTree
+{
+private:
+	/**
+	 * \brief One range of the key space.
+	 */
+	struct Shard
+	{
+		/** The values of the range */
+		BTree<T>* tree;
+		/** Guards the tree and the write statistics */
+		mutex lock;
+		/** The number of inserts and removes since the last rebalance */
+		long long writes = 0;
+		/** A sample of the values written lately, the shard is split at their median */
+		vector<T> recent;
+		/** The number of values written into the sample so far */
+		long long recentCount = 0;
+
+		Shard(BTree<T>* tree) : tree(tree) {}
+	};
+
+	/** The number of values in the sample of each shard */
+	static const int recentCapacity = 64;
+
+	/** The order of the trees */
+	int order;
+	/** The most shards there can be */
+	int maxShards;
+	/** The shards, in the order of their ranges */
+	vector<unique_ptr<Shard>> shards;
+	/** The lowest value of every shard but the first */
+	vector<T> boundaries;
+	/** Guards the shards and the boundaries, held shared by every operation and exclusively to move the boundaries */
+	shared_timed_mutex boundariesMutex;
+
+	/** The number of writes into one shard after which the shards are rebalanced, 0 to rebalance only on request */
+	long long rebalanceInterval = 65536;
+	/** How many times more writes than the average make a shard too hot */
+	double skewFactor = 2;
+	/** The number of shard splits and merges done */
+	long long rebalanceCount = 0;
+
+	int Route(const T& value);
+	bool NoteWrite(Shard& shard, const T& value);
+	void RebalanceIfDue();
+	bool InternalRebalance();
+	bool SplitShard(int index);
+	void MergeShards(int index);
+
+public:
+	ShardedBTree(int order, int maxShards);
+	~ShardedBTree();
+
+	void Insert(T value);
+	bool Find(T value);
+	void Remove(T value);
+
+	void BulkLoad(vector<T> values);
+	void ForEachRange(T lo, T hi, const function<void(const T&)>& callback);
+
+	bool Rebalance();
+	void SetRebalancing(long long interval, double skewFactor = 2);
+	void Defragment(DefragmentOrder order = DefragmentOrder::BreadthFirst);
+
+	int GetShardCount();
+	long long GetRebalanceCount();
+
+	void PrintStats();
+};
@@ -0,0 +1,157 @@
+/*****************************************************************//**
+ * \file   ThreadPool.cpp
+ * \brief  ThreadPool cpp file
+ * 
+ * \author Kkobari
+ * \date   November 2022
+ *********************************************************************/
+
+#include "ThreadPool.h"
+
+/**
+ * Constructs the pool and starts its workers.
+ * 
+ * \param threadCount The number of workers, 0 means one per hardware thread
+ */
+ThreadPool::ThreadPool(int threadCount)
+{
+	if (threadCount <= 0)
+		threadCount = thread::hardware_concurrency();
+	if (threadCount <= 0)
+		threadCount = 1;
+
+	for (int i = 0; i < threadCount; i++)
+		workers.emplace_back(&ThreadPool::WorkerLoop, this);
+}
+
+/**
+ * Finishes the queued tasks and joins the workers.
+ */
+ThreadPool::~ThreadPool()
+{
+	{
+		lock_guard<mutex> lock(tasksMutex);
+		stopping = true;
+	}
+	tasksChanged.notify_all();
+
+	for (auto& worker : workers)
+		worker.join();
+}
+
+/**
+ * Takes tasks from the queue and runs them until the pool stops.
+ */
+void ThreadPool::WorkerLoop()
+{
+	while (true)
+	{
+		function<void()> task;
+
+		{
+			unique_lock<mutex> lock(tasksMutex);
+			tasksChanged.wait(lock, [this] { return stopping || !tasks.empty(); });
+
+			// the queue is drained before the worker quits
+			if (tasks.empty())
+				return;
+
+			task = move(tasks.front());
+			tasks.pop();
+		}
+
+		task();
+	}
+}
+
+/**
+ * Gets the number of workers.
+ * 
+ * \return The number of workers
+ */
+int ThreadPool::GetThreadCount()
+{
+	return workers.size();
+}
+
+/**
+ * Queues a task to be run by one of the workers.
+ * 
+ * \param task The task to run
+ */
+void ThreadPool::Submit(function<void()> task)
+{
+	{
+		lock_guard<mutex> lock(tasksMutex);
+		tasks.push(move(task));
+	}
+	tasksChanged.notify_one();
+}
+
+/**
+ * Runs body(0) .. body(count - 1) on the workers and waits until all of them finish.
+ * Must not be called from inside a task of the same pool. If iterations throw, the others still run
+ * and the first exception is thrown again on the calling thread once all are done.
+ * 
+ * \param count The number of iterations
+ * \param body The iteration to run
+ */
+void ThreadPool::ParallelFor(int count, const function<void(int)>& body)
+{
+	if (count <= 0)
+		return;
+
+	// a single iteration is not worth the hand-off
+	if (count == 1)
+	{
+		body(0);
+		return;
+	}
+
+	mutex doneMutex;
+	condition_variable doneChanged;
+	int remaining = count;
+	exception_ptr firstError;
+
+	for (int i = 0; i < count; i++)
+	{
+		Submit([&, i]
+		{
+			// an escaping exception would end the worker and leave the caller waiting forever
+			exception_ptr error;
+			try
+			{
+				body(i);
+			}
+			catch (...)
+			{
+				error = current_exception();
+			}
+
+			lock_guard<mutex> lock(doneMutex);
+			if (error && !firstError)
+				firstError = error;
+			if (--remaining == 0)
+				doneChanged.notify_one();
+		});
+	}
+
+	{
+		unique_lock<mutex> lock(doneMutex);
+		doneChanged.wait(lock, [&] { return remaining == 0; });
+	}
+
+	if (firstError)
+		rethrow_exception(firstError);
+}
+
+/**
+ * Gets the pool shared by the tree operations that don't get their own.
+ * 
+ * \return The shared pool with one worker per hardware thread
+ */
+ThreadPool& ThreadPool::Default()
+{
+	static ThreadPool pool;
+	return pool;
+}
@@ -0,0 +1,49 @@
+/*****************************************************************//**
+ * \file   ThreadPool.h
+ * \brief  ThreadPool header file
+ * 
+ * \author Kkobari
+ * \date   November 2022
+ *********************************************************************/
+
+#pragma once
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+
+using namespace std;
+
+/**
+ * \brief A fixed set of worker threads that run queued tasks.
+ */
+class ThreadPool
+{
+private:
+	/** The worker threads */
+	vector<thread> workers;
+	/** The tasks waiting to be picked up by a worker */
+	queue<function<void()>> tasks;
+	/** Guards the task queue */
+	mutex tasksMutex;
+	/** Signals workers that a task was queued or the pool is stopping */
+	condition_variable tasksChanged;
+	/** Whether the pool is shutting down */
+	bool stopping = false;
+
+	void WorkerLoop();
+
+public:
+	ThreadPool(int threadCount = 0);
+	~ThreadPool();
+
+	int GetThreadCount();
+
+	void Submit(function<void()> task);
+	void ParallelFor(int count, const function<void(int)>& body);
+
+	static ThreadPool& Default();
+};
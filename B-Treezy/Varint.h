@@ -0,0 +1,102 @@
+/*****************************************************************//**
+ * \file   Varint.h
+ * \brief  The variable length numbers shared by the workload traces and the cold blocks
+ *
+ * Unsigned numbers are stored in 7-bit groups from the lowest, the high bit of a byte marking that
+ * more groups follow. Signed differences are zigzag encoded first, so small negative ones stay small too.
+ *
+ * \author Kkobari
+ * \date   November 2022
+ *********************************************************************/
+
+#pragma once
+#include <vector>
+
+using namespace std;
+
+/**
+ * \brief Appends variable length numbers to a buffer and reads them back.
+ */
+struct Varint
+{
+	/**
+	 * Appends an unsigned number.
+	 *
+	 * \param bytes The bytes to append to
+	 * \param value The number
+	 */
+	static void Put(vector<char>& bytes, unsigned long long value)
+	{
+		while (value >= 0x80)
+		{
+			bytes.push_back((char)(value | 0x80));
+			value >>= 7;
+		}
+		bytes.push_back((char)value);
+	}
+
+	/**
+	 * Reads a number stored by Put, byte by byte from a source which may run out.
+	 *
+	 * \param value The number read
+	 * \param readByte Reads the next byte into its argument, returns false if there are no more
+	 * \return False if the bytes ran out or the number doesn't fit into 64 bits
+	 */
+	template <class ReadByte>
+	static bool Get(unsigned long long& value, ReadByte readByte)
+	{
+		value = 0;
+
+		for (int shift = 0; shift < 64; shift += 7)
+		{
+			unsigned char byte;
+			if (!readByte(byte))
+				return false;
+
+			value |= (unsigned long long)(byte & 0x7F) << shift;
+			if ((byte & 0x80) == 0)
+				return true;
+		}
+
+		return false;
+	}
+
+	/**
+	 * Reads a number stored by Put from memory known to hold it.
+	 *
+	 * \param position The position to read from, moved past the number
+	 * \return The number
+	 */
+	static unsigned long long Get(const char*& position)
+	{
+		unsigned long long value;
+		Get(value, [&](unsigned char& byte) { byte = *position++; return true; });
+		return value;
+	}
+
+	/**
+	 * Gets the zigzag encoded difference of two numbers, which wraps around instead of overflowing.
+	 *
+	 * \param previous The number the difference is taken from
+	 * \param value The number
+	 * \return The difference, small for numbers close to each other
+	 */
+	static unsigned long long ZigzagDelta(long long previous, long long value)
+	{
+		unsigned long long delta = (unsigned long long)value - (unsigned long long)previous;
+		return (delta << 1) ^ (unsigned long long)((long long)delta >> 63);
+	}
+
+	/**
+	 * Adds a difference made by ZigzagDelta back to the number it was taken from.
+	 *
+	 * \param previous The number the difference was taken from
+	 * \param zigzag The difference
+	 * \return The number
+	 */
+	static long long AddZigzagDelta(long long previous, unsigned long long zigzag)
+	{
+		unsigned long long delta = (zigzag >> 1) ^ (0 - (zigzag & 1));
+		return (long long)((unsigned long long)previous + delta);
+	}
+};
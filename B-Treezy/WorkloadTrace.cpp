@@ -0,0 +1,417 @@
+/*****************************************************************//**
+ * \file   WorkloadTrace.cpp
+ * \brief  Compact binary traces of the tree operations
+ * 
+ * \author Kkobari
+ * \date   November 2022
+ *********************************************************************/
+
+#include "WorkloadTrace.h"
+
+/** The first bytes of every trace */
+static const char traceMagic[4] = { 'B', 'T', 'R', 'C' };
+/** The version of the format */
+static const unsigned char traceVersion = 1;
+/** The size of the blocks the traces are written and read in */
+static const size_t traceBlockSize = 1 << 16;
+
+template <class T>
+TraceKeyType GetTraceKeyType();
+
+template <>
+TraceKeyType GetTraceKeyType<int>()
+{
+	return TraceKeyType::Int32;
+}
+
+template <>
+TraceKeyType GetTraceKeyType<long long>()
+{
+	return TraceKeyType::Int64;
+}
+
+template <>
+TraceKeyType GetTraceKeyType<string>()
+{
+	return TraceKeyType::String;
+}
+
+template <>
+TraceKeyType GetTraceKeyType<Counted<int>>()
+{
+	return TraceKeyType::CountedInt32;
+}
+
+template <>
+TraceKeyType GetTraceKeyType<Counted<long long>>()
+{
+	return TraceKeyType::CountedInt64;
+}
+
+template <>
+TraceKeyType GetTraceKeyType<Counted<string>>()
+{
+	return TraceKeyType::CountedString;
+}
+
+/**
+ * Appends an integer key as the zigzag encoded difference from the previous key, so close keys take a byte or two.
+ * 
+ * \param buffer The buffer to append to
+ * \param previous The previous key, replaced with the key
+ * \param key The key
+ */
+template <class I>
+static void EncodeKey(vector<char>& buffer, I& previous, const I& key)
+{
+	Varint::Put(buffer, Varint::ZigzagDelta(previous, key));
+	previous = key;
+}
+
+/**
+ * Appends a string key as its length and bytes.
+ * 
+ * \param buffer The buffer to append to
+ * \param previous Unused, strings are stored whole
+ * \param key The key
+ */
+static void EncodeKey(vector<char>& buffer, string& previous, const string& key)
+{
+	Varint::Put(buffer, key.size());
+	buffer.insert(buffer.end(), key.begin(), key.end());
+}
+
+/**
+ * Appends a counted key as its key and count.
+ * 
+ * \param buffer The buffer to append to
+ * \param previous The previous key, its key is replaced with the key
+ * \param key The key
+ */
+template <class K>
+static void EncodeKey(vector<char>& buffer, Counted<K>& previous, const Counted<K>& key)
+{
+	EncodeKey(buffer, previous.key, key.key);
+	Varint::Put(buffer, key.count);
+}
+
+/**
+ * Reads an integer key stored by EncodeKey.
+ * 
+ * \param reader The reader to read from
+ * \param previous The previous key, replaced with the key
+ * \param key The key read
+ * \return False if the trace ended
+ */
+template <class Reader, class I>
+static bool DecodeKey(Reader& reader, I& previous, I& key)
+{
+	unsigned long long zigzag;
+	if (!reader.GetVarint(zigzag))
+		return false;
+
+	key = (I)Varint::AddZigzagDelta(previous, zigzag);
+	previous = key;
+	return true;
+}
+
+/**
+ * Reads a string key stored by EncodeKey.
+ * 
+ * \param reader The reader to read from
+ * \param previous Unused, strings are stored whole
+ * \param key The key read
+ * \return False if the trace ended
+ */
+template <class Reader>
+static bool DecodeKey(Reader& reader, string& previous, string& key)
+{
+	unsigned long long length;
+	return reader.GetVarint(length) && reader.GetBytes(key, length);
+}
+
+/**
+ * Reads a counted key stored by EncodeKey.
+ * 
+ * \param reader The reader to read from
+ * \param previous The previous key, its key is replaced with the key
+ * \param key The key read
+ * \return False if the trace ended
+ */
+template <class Reader, class K>
+static bool DecodeKey(Reader& reader, Counted<K>& previous, Counted<K>& key)
+{
+	unsigned long long count;
+	if (!DecodeKey(reader, previous.key, key.key) || !reader.GetVarint(count))
+		return false;
+
+	key.count = count;
+	return true;
+}
+
+/**
+ * Reads the header of a trace and the type of its keys.
+ * 
+ * \param stream The stream to read from, it is left right after the header
+ * \return The key type, Invalid if the stream isn't a trace
+ */
+TraceKeyType ReadTraceKeyType(istream& stream)
+{
+	char header[6];
+	if (!stream.read(header, sizeof(header)) || !equal(traceMagic, traceMagic + 4, header) || (unsigned char)header[4] != traceVersion)
+		return TraceKeyType::Invalid;
+
+	unsigned char keyType = header[5];
+	if (keyType > (unsigned char)TraceKeyType::CountedString)
+		return TraceKeyType::Invalid;
+
+	return (TraceKeyType)keyType;
+}
+
+/**
+ * Constructs the writer and writes the header of the trace.
+ * 
+ * \param stream The stream to write to, should be opened in binary mode
+ */
+template <class T>
+TraceWriter<T>::TraceWriter(ostream& stream) : stream(stream), previous()
+{
+	buffer.reserve(traceBlockSize + 64);
+	buffer.insert(buffer.end(), traceMagic, traceMagic + 4);
+	buffer.push_back(traceVersion);
+	buffer.push_back((char)GetTraceKeyType<T>());
+}
+
+/**
+ * Writes the rest of the buffer.
+ */
+template <class T>
+TraceWriter<T>::~TraceWriter()
+{
+	Flush();
+}
+
+/**
+ * Appends a key to the buffer.
+ * 
+ * \param key The key
+ */
+template <class T>
+void TraceWriter<T>::PutKey(const T& key)
+{
+	EncodeKey(buffer, previous, key);
+}
+
+/**
+ * Records an operation on one key.
+ * 
+ * \param operation The operation
+ * \param key Its key
+ */
+template <class T>
+void TraceWriter<T>::Write(TraceOperation operation, const T& key)
+{
+	buffer.push_back((char)operation);
+	PutKey(key);
+	recordCount++;
+
+	if (buffer.size() >= traceBlockSize)
+		Flush();
+}
+
+/**
+ * Records a range operation.
+ * 
+ * \param operation The operation
+ * \param key The lowest key of the range
+ * \param high The highest key of the range
+ */
+template <class T>
+void TraceWriter<T>::Write(TraceOperation operation, const T& key, const T& high)
+{
+	buffer.push_back((char)operation);
+	PutKey(key);
+	PutKey(high);
+	recordCount++;
+
+	if (buffer.size() >= traceBlockSize)
+		Flush();
+}
+
+/**
+ * Writes the buffer into the stream.
+ */
+template <class T>
+void TraceWriter<T>::Flush()
+{
+	if (buffer.empty())
+		return;
+
+	stream.write(buffer.data(), buffer.size());
+	stream.flush();
+	buffer.clear();
+}
+
+/**
+ * Gets the number of records written.
+ * 
+ * \return The number of records
+ */
+template <class T>
+long long TraceWriter<T>::GetRecordCount()
+{
+	return recordCount;
+}
+
+/**
+ * Constructs the reader and checks the header of the trace.
+ * 
+ * \param stream The stream to read from, should be opened in binary mode
+ */
+template <class T>
+TraceReader<T>::TraceReader(istream& stream) : stream(stream), previous()
+{
+	buffer.resize(traceBlockSize);
+
+	if (ReadTraceKeyType(stream) != GetTraceKeyType<T>())
+		corrupt = true;
+}
+
+/**
+ * Reads the next block of the stream into the buffer.
+ * 
+ * \return False if the stream has ended
+ */
+template <class T>
+bool TraceReader<T>::Refill()
+{
+	stream.read(buffer.data(), buffer.size());
+	size = stream.gcount();
+	position = 0;
+
+	return size > 0;
+}
+
+/**
+ * Reads one byte.
+ * 
+ * \param byte The byte read
+ * \return False if the trace ended
+ */
+template <class T>
+bool TraceReader<T>::GetByte(unsigned char& byte)
+{
+	if (position == size && !Refill())
+		return false;
+
+	byte = buffer[position++];
+	return true;
+}
+
+/**
+ * Reads an unsigned number stored in 7-bit groups.
+ * 
+ * \param value The number read
+ * \return False if the trace ended
+ */
+template <class T>
+bool TraceReader<T>::GetVarint(unsigned long long& value)
+{
+	return Varint::Get(value, [this](unsigned char& byte) { return GetByte(byte); });
+}
+
+/**
+ * Reads a number of bytes into a string.
+ * 
+ * \param bytes The bytes read
+ * \param count The number of bytes
+ * \return False if the trace ended
+ */
+template <class T>
+bool TraceReader<T>::GetBytes(string& bytes, size_t count)
+{
+	bytes.clear();
+
+	while (bytes.size() < count)
+	{
+		if (position == size && !Refill())
+			return false;
+
+		size_t chunk = min(count - bytes.size(), size - position);
+		bytes.append(buffer.data() + position, chunk);
+		position += chunk;
+	}
+
+	return true;
+}
+
+/**
+ * Reads a key.
+ * 
+ * \param key The key read
+ * \return False if the trace ended
+ */
+template <class T>
+bool TraceReader<T>::GetKey(T& key)
+{
+	return DecodeKey(*this, previous, key);
+}
+
+/**
+ * Reads the next record.
+ * 
+ * \param record The record read
+ * \return False at the end of the trace or if the trace is corrupt
+ */
+template <class T>
+bool TraceReader<T>::Read(TraceRecord<T>& record)
+{
+	if (corrupt)
+		return false;
+
+	unsigned char operation;
+	if (!GetByte(operation))
+		return false;
+
+	if (operation >= traceOperationCount)
+	{
+		corrupt = true;
+		return false;
+	}
+
+	record.operation = (TraceOperation)operation;
+
+	bool complete = GetKey(record.key);
+	if (complete && (record.operation == TraceOperation::Scan || record.operation == TraceOperation::RemoveRange))
+		complete = GetKey(record.high);
+
+	if (!complete)
+		corrupt = true;
+
+	return complete;
+}
+
+/**
+ * Checks whether the header was wrong or the last record was cut short.
+ * 
+ * \return True if the trace is corrupt
+ */
+template <class T>
+bool TraceReader<T>::IsCorrupt()
+{
+	return corrupt;
+}
+
+// the member functions are defined here and not in the header, so the traces used elsewhere are instantiated here
+template class TraceWriter<int>;
+template class TraceWriter<long long>;
+template class TraceWriter<string>;
+template class TraceReader<int>;
+template class TraceReader<long long>;
+template class TraceReader<string>;
+template class TraceWriter<Counted<int>>;
+template class TraceWriter<Counted<long long>>;
+template class TraceWriter<Counted<string>>;
+template class TraceReader<Counted<int>>;
+template class TraceReader<Counted<long long>>;
+template class TraceReader<Counted<string>>;
@@ -0,0 +1,168 @@
+/*****************************************************************//**
+ * \file   WorkloadTrace.h
+ * \brief  Compact binary traces of the tree operations, for replaying workloads offline
+ * 
+ * A trace starts with the magic "BTRC", a version byte and the key type byte.
+ * Each record is an operation byte followed by its key (and the high key of range operations).
+ * Integer keys are stored as zigzag varint deltas from the previous key, strings as a varint length and the bytes.
+ * Counted keys are followed by their count as a varint. Posting lists are not recorded.
+ * 
+ * \author Kkobari
+ * \date   November 2022
+ *********************************************************************/
+
+#pragma once
+#include <iostream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include "Multiset.h"
+#include "Varint.h"
+
+using namespace std;
+
+/**
+ * \brief The operations a trace can hold.
+ */
+enum class TraceOperation : unsigned char
+{
+	Insert,
+	Find,
+	Remove,
+	/** ForEachRange from key to high */
+	Scan,
+	/** RemoveRange from key to high */
+	RemoveRange
+};
+
+/** The number of operations a trace can hold */
+const int traceOperationCount = 5;
+
+/**
+ * \brief The key types a trace can hold, stored in its header.
+ */
+enum class TraceKeyType : unsigned char
+{
+	Int32,
+	Int64,
+	String,
+	CountedInt32,
+	CountedInt64,
+	CountedString,
+	/** Not a trace or an unknown version */
+	Invalid = 255
+};
+
+TraceKeyType ReadTraceKeyType(istream& stream);
+
+/**
+ * \brief One recorded operation.
+ */
+template <class T>
+struct TraceRecord
+{
+	/** The operation */
+	TraceOperation operation;
+	/** Its key, the lowest key for range operations */
+	T key;
+	/** The highest key for range operations */
+	T high;
+};
+
+/**
+ * \brief Writes records into a stream. The records are collected in its own buffer and written in large blocks,
+ * the rest is written when the writer is flushed or destroyed.
+ */
+template <class T>
+class TraceWriter
+{
+private:
+	/** The stream written to */
+	ostream& stream;
+	/** The encoded records not yet written to the stream */
+	vector<char> buffer;
+	/** The last key written, keys are stored relative to it */
+	T previous;
+	/** The number of records written */
+	long long recordCount = 0;
+
+	void PutKey(const T& key);
+
+public:
+	TraceWriter(ostream& stream);
+	~TraceWriter();
+
+	void Write(TraceOperation operation, const T& key);
+	void Write(TraceOperation operation, const T& key, const T& high);
+	void Flush();
+
+	long long GetRecordCount();
+};
+
+/**
+ * \brief Reads records from a stream, in large blocks.
+ */
+template <class T>
+class TraceReader
+{
+private:
+	/** The stream read from */
+	istream& stream;
+	/** The bytes read from the stream */
+	vector<char> buffer;
+	/** The position of the next byte within the buffer */
+	size_t position = 0;
+	/** The number of valid bytes in the buffer */
+	size_t size = 0;
+	/** The last key read, keys are stored relative to it */
+	T previous;
+	/** Whether the header was wrong or a record was cut short */
+	bool corrupt = false;
+
+	bool Refill();
+	bool GetKey(T& key);
+
+public:
+	TraceReader(istream& stream);
+
+	bool GetByte(unsigned char& byte);
+	bool GetVarint(unsigned long long& value);
+	bool GetBytes(string& bytes, size_t count);
+
+	bool Read(TraceRecord<T>& record);
+	bool IsCorrupt();
+};
+
+/**
+ * Records an operation on one key.
+ * 
+ * \param writer The writer
+ * \param operation The operation
+ * \param key Its key
+ */
+template <class T>
+void RecordTrace(TraceWriter<T>* writer, TraceOperation operation, const T& key)
+{
+	writer->Write(operation, key);
+}
+
+/**
+ * Records a range operation.
+ * 
+ * \param writer The writer
+ * \param operation The operation
+ * \param key The lowest key of the range
+ * \param high The highest key of the range
+ */
+template <class T>
+void RecordTrace(TraceWriter<T>* writer, TraceOperation operation, const T& key, const T& high)
+{
+	writer->Write(operation, key, high);
+}
+
+// the payloads of posting lists can be of any type, so they have no encoding and are not recorded
+template <class K, class P>
+void RecordTrace(TraceWriter<Posting<K, P>>* writer, TraceOperation operation, const Posting<K, P>& key) {}
+
+template <class K, class P>
+void RecordTrace(TraceWriter<Posting<K, P>>* writer, TraceOperation operation, const Posting<K, P>& key, const Posting<K, P>& high) {}
@@ -11,7 +11,10 @@
 
 int main()
 {
-	BTree* tree = new BTree(5);
+	BTree<int>* tree = new BTree<int>(5);
+
+	// show the nodes from the first value on instead of a flat array
+	tree->SetFlatCapacity(0);
 
 	tree->PrintInfo();
 
@@ -0,0 +1,872 @@
+/*****************************************************************//**
+ * \file   Benchmark.cpp
+ * \brief  Benchmarks of the tree against std::set and a sorted vector
+ * 
+ * Every workload is run on each structure, key type and tree order and
+ * printed as one CSV (or JSON) line, so runs can be compared over time.
+ * 
+ *   Benchmark [--n 100000] [--seed 1] [--orders 4,16,64,256] [--json]
+ * 
+ * With --paged, the tree is written into a page file at the given path instead and random
+ * lookups are read back from it with 1 to 64 reads in flight, through io_uring and a thread pool.
+ * 
+ *   Benchmark --paged pages.bin [--n 100000] [--seed 1]
+ * 
+ * With --sharded, uniform and Zipfian inserts are spread over 1 up to the given number of threads,
+ * writing into a sharded tree with a shard per thread, and the inserts per second of each are printed.
+ * 
+ *   Benchmark --sharded 8 [--n 100000] [--seed 1]
+ * 
+ * With --small, many small trees of 16 to 128 values are built, once as flat arrays and once as nodes,
+ * and the memory per tree and the time per lookup of each are printed.
+ * 
+ *   Benchmark --small [--n 100000] [--seed 1]
+ * 
+ * With --tiered, Zipfian lookups into a small hot key range run on a tree whose nodes may hold 100% down to 5%
+ * of their full size, the rest being kept in compressed cold blocks, and the hot and cold bytes and the time per lookup are printed.
+ * 
+ *   Benchmark --tiered [--n 100000] [--seed 1]
+ * 
+ * \author Kkobari
+ * \date   November 2022
+ *********************************************************************/
+
+#include "../B-Treezy/BTree.h"
+#include "../B-Treezy/ShardedBTree.h"
+#include <set>
+#include <string>
+#include <chrono>
+#include <random>
+#include <atomic>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <thread>
+
+using namespace std;
+using namespace std::chrono;
+
+/** The number of bytes currently allocated through operator new */
+static atomic<long long> allocatedBytes(0);
+
+/** Collects the results of lookups and scans, so the compiler can't drop them */
+static volatile long long sink = 0;
+
+// every allocation is prefixed with its size, so the live memory of a structure can be measured exactly
+void* operator new(size_t size)
+{
+	size_t* block = (size_t*)malloc(size + sizeof(max_align_t));
+	if (block == nullptr)
+		throw bad_alloc();
+
+	*block = size;
+	allocatedBytes += size;
+	return (char*)block + sizeof(max_align_t);
+}
+
+void operator delete(void* pointer) noexcept
+{
+	if (pointer == nullptr)
+		return;
+
+	size_t* block = (size_t*)((char*)pointer - sizeof(max_align_t));
+	allocatedBytes -= *block;
+	free(block);
+}
+
+void operator delete(void* pointer, size_t) noexcept
+{
+	operator delete(pointer);
+}
+
+// the nothrow forms (used by stable_sort for its buffer) must go through the same prefix
+void* operator new(size_t size, const nothrow_t&) noexcept
+{
+	try
+	{
+		return operator new(size);
+	}
+	catch (const bad_alloc&)
+	{
+		return nullptr;
+	}
+}
+
+void operator delete(void* pointer, const nothrow_t&) noexcept
+{
+	operator delete(pointer);
+}
+
+/**
+ * \brief The parameters of a benchmark run.
+ */
+struct Options
+{
+	/** The number of keys each workload works with */
+	int n = 100000;
+	/** The seed of all random sequences */
+	unsigned seed = 1;
+	/** The tree orders to measure */
+	vector<int> orders = { 4, 16, 64, 256 };
+	/** Whether to print JSON lines instead of CSV */
+	bool json = false;
+	/** The page file to measure asynchronous lookups on, none to run the other workloads */
+	string pagedPath;
+	/** The most threads to measure the sharded tree with, 0 to run the other workloads */
+	int shardedThreads = 0;
+	/** Whether to measure many small trees instead of the other workloads */
+	bool small = false;
+	/** Whether to measure a tree with cold subtrees instead of the other workloads */
+	bool tiered = false;
+};
+
+/**
+ * \brief The measured result of one workload.
+ */
+struct Result
+{
+	string structure;
+	string keyType;
+	int order = 0;
+	string workload;
+	long long operations = 0;
+	double seconds = 0;
+	double p50 = 0;
+	double p99 = 0;
+	long long memoryBytes = 0;
+};
+
+/**
+ * Makes the key with a given rank. Keys grow with their rank, so ranges of ranks are ranges of keys.
+ * 
+ * \param rank The rank of the key
+ * \return The key
+ */
+template <class K>
+K MakeKey(long long rank);
+
+template <>
+int MakeKey<int>(long long rank)
+{
+	return rank;
+}
+
+template <>
+long long MakeKey<long long>(long long rank)
+{
+	// spread over the whole 64-bit range
+	return rank * 1000000007LL;
+}
+
+template <>
+string MakeKey<string>(long long rank)
+{
+	char buffer[32];
+	snprintf(buffer, sizeof(buffer), "key%016lld", rank);
+	return buffer;
+}
+
+/**
+ * \brief Draws ranks from a Zipfian distribution, rank 0 being the most popular one.
+ */
+class Zipf
+{
+private:
+	/** The cumulative probability of each rank */
+	vector<double> cdf;
+
+public:
+	/**
+	 * Precomputes the distribution.
+	 * 
+	 * \param count The number of ranks
+	 * \param skew The exponent, 0.99 is the usual YCSB setting
+	 */
+	Zipf(int count, double skew)
+	{
+		double sum = 0;
+		for (int i = 0; i < count; i++)
+		{
+			sum += 1.0 / pow(i + 1, skew);
+			cdf.push_back(sum);
+		}
+		for (auto& value : cdf)
+			value /= sum;
+	}
+
+	/**
+	 * Draws the next rank.
+	 * 
+	 * \param rng The random generator
+	 * \return The rank
+	 */
+	int Next(mt19937_64& rng)
+	{
+		double u = uniform_real_distribution<double>(0, 1)(rng);
+		return min<int>(lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin(), cdf.size() - 1);
+	}
+};
+
+/**
+ * \brief The tree behind the common interface of the measured structures.
+ */
+template <class K>
+class TreeStructure
+{
+private:
+	BTree<K>* tree;
+
+public:
+	TreeStructure(int order) { tree = new BTree<K>(order); }
+	~TreeStructure() { delete tree; }
+
+	// duplicates are skipped quietly, in the same descent as the insert
+	void Insert(const K& key) { tree->TryInsert(key); }
+	void InsertNew(const K& key) { tree->Insert(key); }
+	bool Find(const K& key) { return tree->Find(key); }
+	void Remove(const K& key) { tree->Remove(key); }
+	long long Scan(const K& lo, const K& hi)
+	{
+		long long count = 0;
+		tree->ForEachRange(lo, hi, [&](const K&) { count++; });
+		return count;
+	}
+};
+
+/**
+ * \brief std::set behind the common interface of the measured structures.
+ */
+template <class K>
+class SetStructure
+{
+private:
+	set<K> values;
+
+public:
+	// the order only matters to the tree
+	SetStructure(int) {}
+
+	void Insert(const K& key) { values.insert(key); }
+	void InsertNew(const K& key) { values.insert(key); }
+	bool Find(const K& key) { return values.find(key) != values.end(); }
+	void Remove(const K& key) { values.erase(key); }
+	long long Scan(const K& lo, const K& hi)
+	{
+		long long count = 0;
+		for (auto it = values.lower_bound(lo); it != values.end() && !(hi < *it); ++it)
+			count++;
+		return count;
+	}
+};
+
+/**
+ * \brief A sorted vector behind the common interface of the measured structures.
+ */
+template <class K>
+class VectorStructure
+{
+private:
+	vector<K> values;
+
+public:
+	// the order only matters to the tree
+	VectorStructure(int) {}
+
+	void Insert(const K& key)
+	{
+		auto it = lower_bound(values.begin(), values.end(), key);
+		if (it == values.end() || key < *it)
+			values.insert(it, key);
+	}
+	void InsertNew(const K& key) { Insert(key); }
+	bool Find(const K& key) { return binary_search(values.begin(), values.end(), key); }
+	void Remove(const K& key)
+	{
+		auto it = lower_bound(values.begin(), values.end(), key);
+		if (it != values.end() && !(key < *it))
+			values.erase(it);
+	}
+	long long Scan(const K& lo, const K& hi)
+	{
+		long long count = 0;
+		for (auto it = lower_bound(values.begin(), values.end(), lo); it != values.end() && !(hi < *it); ++it)
+			count++;
+		return count;
+	}
+};
+
+/**
+ * \brief Times a sequence of operations. Every 16th operation is timed on its own for the latency percentiles.
+ */
+class Timer
+{
+private:
+	/** The sampled latencies in nanoseconds */
+	vector<double> samples;
+	/** The start of the whole run */
+	steady_clock::time_point start;
+	/** The number of operations run */
+	long long operations = 0;
+
+public:
+	Timer() { start = steady_clock::now(); }
+
+	/**
+	 * Runs and counts one operation.
+	 * 
+	 * \param operation The operation to run
+	 */
+	template <class F>
+	void Run(F operation)
+	{
+		if ((operations++ & 15) != 0)
+		{
+			operation();
+			return;
+		}
+
+		auto before = steady_clock::now();
+		operation();
+		samples.push_back(duration<double, nano>(steady_clock::now() - before).count());
+	}
+
+	/**
+	 * Fills the timing part of a result.
+	 * 
+	 * \param result The result to fill
+	 */
+	void Finish(Result& result)
+	{
+		result.seconds = duration<double>(steady_clock::now() - start).count();
+		result.operations = operations;
+
+		if (samples.empty())
+			return;
+
+		sort(samples.begin(), samples.end());
+		result.p50 = samples[samples.size() / 2];
+		result.p99 = samples[min(samples.size() - 1, samples.size() * 99 / 100)];
+	}
+};
+
+/**
+ * Prints a result as one line.
+ * 
+ * \param result The result to print
+ * \param options The options of the run
+ */
+void PrintResult(const Result& result, const Options& options)
+{
+	double nsPerOp = result.operations > 0 ? result.seconds * 1e9 / result.operations : 0;
+	double opsPerSec = result.seconds > 0 ? result.operations / result.seconds : 0;
+
+	if (options.json)
+	{
+		printf("{\"structure\":\"%s\",\"key\":\"%s\",\"order\":%d,\"workload\":\"%s\",\"n\":%d,\"ops\":%lld,"
+			"\"ns_per_op\":%.1f,\"ops_per_sec\":%.0f,\"p50_ns\":%.0f,\"p99_ns\":%.0f,\"memory_bytes\":%lld}\n",
+			result.structure.c_str(), result.keyType.c_str(), result.order, result.workload.c_str(), options.n, result.operations,
+			nsPerOp, opsPerSec, result.p50, result.p99, result.memoryBytes);
+	}
+	else
+	{
+		printf("%s,%s,%d,%s,%d,%lld,%.1f,%.0f,%.0f,%.0f,%lld\n",
+			result.structure.c_str(), result.keyType.c_str(), result.order, result.workload.c_str(), options.n, result.operations,
+			nsPerOp, opsPerSec, result.p50, result.p99, result.memoryBytes);
+	}
+	fflush(stdout);
+}
+
+/**
+ * Runs all workloads on one structure and key type.
+ * 
+ * \param structureName The name of the structure for the output
+ * \param keyType The name of the key type for the output
+ * \param order The order of the tree, 0 for the other structures
+ * \param options The options of the run
+ */
+template <class S, class K>
+void RunWorkloads(const string& structureName, const string& keyType, int order, const Options& options)
+{
+	int n = options.n;
+	mt19937_64 rng(options.seed);
+
+	// the keys with even ranks are inserted, the odd ones are used for misses
+	vector<K> keys;
+	for (int i = 0; i < n; i++)
+		keys.push_back(MakeKey<K>(2LL * i));
+
+	vector<K> shuffled = keys;
+	shuffle(shuffled.begin(), shuffled.end(), rng);
+
+	auto run = [&](const string& workload, const function<void(S&, Timer&)>& prepare, const function<void(S&, Timer&)>& body)
+	{
+		Result result;
+		result.structure = structureName;
+		result.keyType = keyType;
+		result.order = order;
+		result.workload = workload;
+
+		long long before = allocatedBytes;
+		S* structure = new S(order);
+
+		{
+			Timer unused;
+			prepare(*structure, unused);
+		}
+
+		{
+			Timer timer;
+			body(*structure, timer);
+			timer.Finish(result);
+		}
+
+		// sampled once the timers and their latency samples are gone, so only the structure is counted
+		result.memoryBytes = allocatedBytes - before;
+		delete structure;
+
+		PrintResult(result, options);
+	};
+
+	auto fill = [&](S& structure, Timer&)
+	{
+		for (auto& key : shuffled)
+			structure.InsertNew(key);
+	};
+	auto nothing = [](S&, Timer&) {};
+
+	run("insert_sequential", nothing, [&](S& structure, Timer& timer)
+	{
+		for (auto& key : keys)
+			timer.Run([&] { structure.InsertNew(key); });
+	});
+
+	run("insert_random", nothing, [&](S& structure, Timer& timer)
+	{
+		for (auto& key : shuffled)
+			timer.Run([&] { structure.InsertNew(key); });
+	});
+
+	run("insert_zipf", nothing, [&](S& structure, Timer& timer)
+	{
+		Zipf zipf(n, 0.99);
+		mt19937_64 zipfRng(options.seed + 1);
+
+		// the popular ranks are scattered over the key space
+		for (int i = 0; i < n; i++)
+		{
+			const K& key = shuffled[zipf.Next(zipfRng)];
+			timer.Run([&] { structure.Insert(key); });
+		}
+	});
+
+	run("find_hit", fill, [&](S& structure, Timer& timer)
+	{
+		for (auto& key : shuffled)
+			timer.Run([&] { sink += structure.Find(key); });
+	});
+
+	run("find_miss", fill, [&](S& structure, Timer& timer)
+	{
+		for (int i = 0; i < n; i++)
+		{
+			K key = MakeKey<K>(2LL * (rng() % n) + 1);
+			timer.Run([&] { sink += structure.Find(key); });
+		}
+	});
+
+	// the keys with odd ranks in random order, for the writes of the mixed workloads
+	vector<K> absent;
+	for (int i = 0; i < n; i++)
+		absent.push_back(MakeKey<K>(2LL * i + 1));
+	shuffle(absent.begin(), absent.end(), rng);
+
+	// mixed workloads find present keys and alternate between inserting a new key and removing an inserted one
+	for (int readPercent : { 95, 50 })
+	{
+		run("mixed_" + to_string(readPercent) + "_read", fill, [&](S& structure, Timer& timer)
+		{
+			mt19937_64 mixRng(options.seed + readPercent);
+			vector<K> added;
+			int nextAbsent = 0;
+
+			for (int i = 0; i < n; i++)
+			{
+				if ((int)(mixRng() % 100) < readPercent)
+				{
+					const K& key = shuffled[mixRng() % n];
+					timer.Run([&] { sink += structure.Find(key); });
+				}
+				else if (added.empty() || i % 2 == 0)
+				{
+					added.push_back(absent[nextAbsent++]);
+					const K& key = added.back();
+					timer.Run([&] { structure.InsertNew(key); });
+				}
+				else
+				{
+					K key = added.back();
+					added.pop_back();
+					timer.Run([&] { structure.Remove(key); });
+				}
+			}
+		});
+	}
+
+	run("remove_random", fill, [&](S& structure, Timer& timer)
+	{
+		vector<K> order = shuffled;
+		shuffle(order.begin(), order.end(), rng);
+
+		for (auto& key : order)
+			timer.Run([&] { structure.Remove(key); });
+	});
+
+	run("scan_100", fill, [&](S& structure, Timer& timer)
+	{
+		int scans = max(1, n / 100);
+
+		for (int i = 0; i < scans; i++)
+		{
+			long long first = rng() % n;
+			K lo = MakeKey<K>(2 * first);
+			K hi = MakeKey<K>(2 * (first + 99));
+			timer.Run([&] { sink += structure.Scan(lo, hi); });
+		}
+	});
+}
+
+/**
+ * Runs all structures with one key type.
+ * 
+ * \param keyType The name of the key type for the output
+ * \param options The options of the run
+ */
+template <class K>
+void RunKeyType(const string& keyType, const Options& options)
+{
+	for (int order : options.orders)
+		RunWorkloads<TreeStructure<K>, K>("btree", keyType, order, options);
+
+	RunWorkloads<SetStructure<K>, K>("std_set", keyType, 0, options);
+	RunWorkloads<VectorStructure<K>, K>("sorted_vector", keyType, 0, options);
+}
+
+/**
+ * Measures lookups in a page file with a number of reads in flight, on each backend, and checks a range scan.
+ * 
+ * \param options The options of the run
+ */
+void RunPaged(const Options& options)
+{
+	BTree<long long>* tree = new BTree<long long>(64);
+	vector<long long> keys;
+	for (long long rank = 0; rank < options.n; rank++)
+		keys.push_back(MakeKey<long long>(rank * 2));
+	tree->BulkLoad(keys);
+
+	if (!tree->WritePages(options.pagedPath))
+	{
+		delete tree;
+		return;
+	}
+	delete tree;
+
+	// the odd ranks are misses
+	mt19937_64 random(options.seed);
+	vector<long long> lookups;
+	for (int i = 0; i < options.n; i++)
+		lookups.push_back(MakeKey<long long>(random() % (2LL * options.n)));
+
+	printf("backend,queue_depth,lookups,page_reads,seconds,iops,lookups_per_sec\n");
+
+	for (bool useUring : { true, false })
+	{
+		for (int depth = 1; depth <= 64; depth *= 2)
+		{
+			PagedTree<long long> paged;
+			if (!paged.Open(options.pagedPath, depth, useUring))
+			{
+				printf("can't open %s\n", options.pagedPath.c_str());
+				return;
+			}
+
+			// without io_uring the thread pool is used, it was measured already
+			if (useUring && strcmp(paged.GetBackendName(), "io_uring") != 0)
+				break;
+
+			size_t next = 0;
+			int inFlight = 0;
+			long long wrong = 0;
+			function<void()> startNext;
+			startNext = [&]()
+			{
+				size_t index = next++;
+				inFlight++;
+				paged.FindAsync(lookups[index], [&, index](bool found)
+				{
+					inFlight--;
+					if (found != ((lookups[index] / 1000000007LL) % 2 == 0))
+						wrong++;
+					if (next < lookups.size())
+						startNext();
+				});
+			};
+
+			auto start = steady_clock::now();
+			while (next < lookups.size() && inFlight < depth)
+				startNext();
+			paged.Run();
+			double seconds = duration<double>(steady_clock::now() - start).count();
+
+			printf("%s,%d,%zu,%lld,%.3f,%.0f,%.0f\n", paged.GetBackendName(), depth, lookups.size(), paged.GetPageReads(),
+				seconds, paged.GetPageReads() / seconds, lookups.size() / seconds);
+			if (wrong > 0)
+				printf("%lld lookups returned a wrong result\n", wrong);
+			fflush(stdout);
+		}
+	}
+
+	// a scan over the middle half, reading 8 leaves ahead
+	PagedTree<long long> paged;
+	paged.Open(options.pagedPath, 8);
+	long long lo = keys[keys.size() / 4];
+	long long hi = keys[keys.size() * 3 / 4];
+	long long previous = lo - 1;
+	long long count = 0;
+	bool ordered = true;
+	paged.ScanAsync(lo, hi, 8, [&](const long long& value)
+	{
+		ordered = ordered && previous < value;
+		previous = value;
+		count++;
+	}, [](bool succeeded)
+	{
+		if (!succeeded)
+			printf("the scan failed to read a page\n");
+	});
+	paged.Run();
+
+	if (!ordered || count != (long long)(keys.size() * 3 / 4 - keys.size() / 4 + 1))
+		printf("the scan returned %lld values, %s\n", count, ordered ? "in order" : "out of order");
+}
+
+/**
+ * Measures inserts into a sharded tree from 1 up to a number of threads, with uniform and Zipfian keys,
+ * and checks that every distinct key made it in.
+ * 
+ * \param options The options of the run
+ */
+void RunSharded(const Options& options)
+{
+	vector<long long> uniform;
+	for (long long rank = 0; rank < options.n; rank++)
+		uniform.push_back(MakeKey<long long>(rank));
+	mt19937_64 rng(options.seed);
+	shuffle(uniform.begin(), uniform.end(), rng);
+
+	// the popular ranks are scattered over the key space
+	Zipf zipf(options.n, 0.99);
+	vector<long long> zipfian;
+	for (int i = 0; i < options.n; i++)
+		zipfian.push_back(uniform[zipf.Next(rng)]);
+
+	printf("workload,threads,inserts,seconds,inserts_per_sec,shards,rebalances\n");
+
+	for (auto workload : { make_pair("uniform", &uniform), make_pair("zipf", &zipfian) })
+	{
+		const vector<long long>& keys = *workload.second;
+		vector<long long> distinct = keys;
+		sort(distinct.begin(), distinct.end());
+		distinct.erase(unique(distinct.begin(), distinct.end()), distinct.end());
+
+		for (int threads = 1; threads <= options.shardedThreads; threads *= 2)
+		{
+			// counted keys take repeated inserts as writes instead of complaining about duplicates
+			ShardedBTree<Counted<long long>> tree(64, threads);
+			// rebalance often enough that the shards settle early in the run
+			tree.SetRebalancing(max(1024, options.n / threads / 16));
+
+			vector<thread> writers;
+			auto start = steady_clock::now();
+			for (int t = 0; t < threads; t++)
+			{
+				writers.emplace_back([&, t]()
+				{
+					for (size_t i = t; i < keys.size(); i += threads)
+						tree.Insert(Counted<long long>(keys[i]));
+				});
+			}
+			for (auto& writer : writers)
+				writer.join();
+			double seconds = duration<double>(steady_clock::now() - start).count();
+
+			long long count = 0;
+			tree.ForEachRange(Counted<long long>(distinct.front()), Counted<long long>(distinct.back()), [&](const Counted<long long>&) { count++; });
+
+			printf("%s,%d,%zu,%.3f,%.0f,%d,%lld\n", workload.first, threads, keys.size(), seconds, keys.size() / seconds,
+				tree.GetShardCount(), tree.GetRebalanceCount());
+			if (count != (long long)distinct.size())
+				printf("the tree holds %lld values instead of %zu\n", count, distinct.size());
+			fflush(stdout);
+		}
+	}
+}
+
+/**
+ * Measures the memory and the lookups of many small trees, kept as flat arrays and as nodes.
+ * 
+ * \param options The options of the run, n is the number of values over all trees
+ */
+void RunSmallTrees(const Options& options)
+{
+	printf("representation,values_per_tree,trees,bytes_per_tree,ns_per_find\n");
+
+	for (int size : { 16, 32, 64, 128 })
+	{
+		int treeCount = max(1, options.n / size);
+
+		for (bool flat : { true, false })
+		{
+			mt19937_64 rng(options.seed);
+
+			// the list of trees is reserved up front, so it isn't counted with the trees
+			vector<BTree<int>*> trees;
+			trees.reserve(treeCount);
+			long long before = allocatedBytes;
+
+			for (int t = 0; t < treeCount; t++)
+			{
+				BTree<int>* tree = new BTree<int>(16);
+				tree->SetFlatCapacity(flat ? size : 0);
+				for (int i = 0; i < size; i++)
+					tree->Insert(2 * i);
+				trees.push_back(tree);
+			}
+
+			long long bytes = allocatedBytes - before;
+
+			// half of the lookups miss
+			int finds = max(options.n, 100000);
+			auto start = steady_clock::now();
+			for (int i = 0; i < finds; i++)
+				sink += trees[rng() % treeCount]->Find(rng() % (2 * size));
+			double seconds = duration<double>(steady_clock::now() - start).count();
+
+			printf("%s,%d,%d,%lld,%.1f\n", flat ? "flat" : "nodes", size, treeCount, bytes / treeCount, seconds * 1e9 / finds);
+			fflush(stdout);
+
+			for (auto tree : trees)
+				delete tree;
+		}
+	}
+}
+
+/**
+ * Measures Zipfian lookups into a small hot key range on a tree with shrinking budgets for its nodes.
+ * 
+ * \param options The options of the run
+ */
+void RunTiered(const Options& options)
+{
+	vector<long long> keys;
+	for (long long rank = 0; rank < options.n; rank++)
+		keys.push_back(MakeKey<long long>(rank));
+
+	// the popular ranks are neighbours, starting in the middle of the key space
+	Zipf zipf(options.n, 0.99);
+	auto popular = [&](int rank) { return keys[(rank + options.n / 2) % options.n]; };
+
+	printf("budget_percent,hot_bytes,cold_bytes,ns_per_find\n");
+
+	size_t fullSize = 0;
+	for (int percent : { 100, 50, 20, 10, 5 })
+	{
+		BTree<long long> tree(64);
+		tree.BulkLoad(keys);
+		if (fullSize == 0)
+			fullSize = tree.MemoryUsage().Hot();
+
+		tree.SetTiering(percent == 100 ? 0 : fullSize * percent / 100, 1024);
+
+		// a first round warms the hot set up, the second one is measured
+		int finds = max(options.n, 100000);
+		mt19937_64 zipfRng(options.seed + 1);
+		for (int i = 0; i < finds; i++)
+			sink += tree.Find(popular(zipf.Next(zipfRng)));
+
+		auto start = steady_clock::now();
+		for (int i = 0; i < finds; i++)
+			sink += tree.Find(popular(zipf.Next(zipfRng)));
+		double seconds = duration<double>(steady_clock::now() - start).count();
+
+		TreeMemoryUsage memory = tree.MemoryUsage();
+		printf("%d,%zu,%zu,%.1f\n", percent, memory.Hot(), memory.coldBlocks, seconds * 1e9 / finds);
+		fflush(stdout);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	Options options;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--n") == 0 && i + 1 < argc)
+			options.n = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+			options.seed = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--json") == 0)
+			options.json = true;
+		else if (strcmp(argv[i], "--paged") == 0 && i + 1 < argc)
+			options.pagedPath = argv[++i];
+		else if (strcmp(argv[i], "--sharded") == 0 && i + 1 < argc)
+			options.shardedThreads = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--small") == 0)
+			options.small = true;
+		else if (strcmp(argv[i], "--tiered") == 0)
+			options.tiered = true;
+		else if (strcmp(argv[i], "--orders") == 0 && i + 1 < argc)
+		{
+			options.orders.clear();
+			for (char* order = strtok(argv[++i], ","); order != nullptr; order = strtok(nullptr, ","))
+				options.orders.push_back(atoi(order));
+		}
+		else
+		{
+			printf("usage: %s [--n keys] [--seed seed] [--orders 4,16,64,256] [--json] [--paged file] [--sharded threads] [--small] [--tiered]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (!options.pagedPath.empty())
+	{
+		RunPaged(options);
+		return 0;
+	}
+
+	if (options.shardedThreads > 0)
+	{
+		RunSharded(options);
+		return 0;
+	}
+
+	if (options.small)
+	{
+		RunSmallTrees(options);
+		return 0;
+	}
+
+	if (options.tiered)
+	{
+		RunTiered(options);
+		return 0;
+	}
+
+	if (!options.json)
+		printf("structure,key,order,workload,n,ops,ns_per_op,ops_per_sec,p50_ns,p99_ns,memory_bytes\n");
+
+	RunKeyType<int>("int32", options);
+	RunKeyType<long long>("int64", options);
+	RunKeyType<string>("string", options);
+}
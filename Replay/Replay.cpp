@@ -0,0 +1,372 @@
+/*****************************************************************//**
+ * \file   Replay.cpp
+ * \brief  Replays a recorded workload trace through the tree
+ * 
+ * The trace is streamed from the file in large blocks and applied at full speed.
+ * With more threads, the keys are partitioned by hash between the threads, each
+ * with its own tree, and range operations are run on every partition.
+ * 
+ *   Replay trace.bin [--order 64] [--threads 1] [--sample 16]
+ * 
+ * \author Kkobari
+ * \date   November 2022
+ *********************************************************************/
+
+#include "../B-Treezy/BTree.h"
+#include <fstream>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+using namespace std;
+using namespace std::chrono;
+
+/** Collects the results of the partitions once their threads are done, so the compiler can't drop the operations */
+static volatile long long sink = 0;
+
+/** The names of the operations, in the order of TraceOperation */
+static const char* operationNames[traceOperationCount] = { "insert", "find", "remove", "scan", "remove_range" };
+
+/** The number of records handed over to a thread at once */
+static const int batchSize = 1024;
+/** The number of batches a thread may have waiting before the reader waits for it */
+static const int maxWaitingBatches = 16;
+
+/**
+ * \brief The parameters of a replay.
+ */
+struct Options
+{
+	/** The trace to replay */
+	string path;
+	/** The order of the trees */
+	int order = 64;
+	/** The number of threads, each with its own tree */
+	int threads = 1;
+	/** Every how many operations of a thread one is timed */
+	int sampleEvery = 16;
+};
+
+/**
+ * Hashes a key to pick its partition.
+ * 
+ * \param key The key
+ * \return The hash
+ */
+template <class T>
+size_t HashKey(const T& key)
+{
+	return hash<T>()(key);
+}
+
+template <class K>
+size_t HashKey(const Counted<K>& key)
+{
+	return hash<K>()(key.key);
+}
+
+/**
+ * \brief One partition of the keys with its own tree, applying the records handed to it.
+ */
+template <class T>
+class Partition
+{
+private:
+	/** The tree of the partition */
+	BTree<T>* tree;
+	/** The number of operations applied */
+	long long operations = 0;
+	/** Collects the results of the operations of this partition */
+	long long results = 0;
+
+	/** The batches waiting to be applied */
+	deque<vector<TraceRecord<T>>> batches;
+	/** Whether the reader has handed over all batches */
+	bool finished = false;
+	/** Guards the batches */
+	mutex batchesMutex;
+	/** Signals a new batch or the end of the trace */
+	condition_variable batchReady;
+	/** Signals that a batch was taken */
+	condition_variable batchTaken;
+
+public:
+	/** The sampled latencies of each operation */
+	LatencyHistogram latencies[traceOperationCount];
+	/** Every how many operations one is timed */
+	int sampleEvery;
+
+	Partition(int order, int sampleEvery) : sampleEvery(sampleEvery) { tree = new BTree<T>(order); }
+	~Partition() { delete tree; }
+
+	/**
+	 * Applies one record to the tree. Duplicate inserts and removes of absent keys are applied quietly,
+	 * so they cost a single descent like the rest.
+	 * 
+	 * \param record The record
+	 */
+	void Apply(const TraceRecord<T>& record)
+	{
+		bool sampled = ++operations % sampleEvery == 0;
+		steady_clock::time_point start;
+		if (sampled)
+			start = steady_clock::now();
+
+		switch (record.operation)
+		{
+		case TraceOperation::Insert:
+			results += tree->TryInsert(record.key);
+			break;
+		case TraceOperation::Find:
+			results += tree->Find(record.key);
+			break;
+		case TraceOperation::Remove:
+			results += tree->TryRemove(record.key);
+			break;
+		case TraceOperation::Scan:
+		{
+			long long count = 0;
+			tree->ForEachRange(record.key, record.high, [&](const T&) { count++; });
+			results += count;
+			break;
+		}
+		case TraceOperation::RemoveRange:
+			results += tree->RemoveRange(record.key, record.high);
+			break;
+		}
+
+		if (sampled)
+			latencies[(int)record.operation].Record(duration_cast<nanoseconds>(steady_clock::now() - start).count());
+	}
+
+	/**
+	 * Gets the collected results of the operations, once the thread of the partition is done.
+	 * 
+	 * \return The sum of the results
+	 */
+	long long GetResults()
+	{
+		return results;
+	}
+
+	/**
+	 * Hands a batch over to the thread of the partition, waits while it has too many batches waiting.
+	 * 
+	 * \param batch The batch, moved from
+	 */
+	void Push(vector<TraceRecord<T>>& batch)
+	{
+		unique_lock<mutex> lock(batchesMutex);
+		batchTaken.wait(lock, [&] { return batches.size() < maxWaitingBatches; });
+
+		batches.push_back(move(batch));
+		batch.clear();
+		batchReady.notify_one();
+	}
+
+	/**
+	 * Tells the thread of the partition that no more batches will come.
+	 */
+	void Finish()
+	{
+		lock_guard<mutex> lock(batchesMutex);
+		finished = true;
+		batchReady.notify_one();
+	}
+
+	/**
+	 * Applies the handed over batches until the reader finishes.
+	 */
+	void Run()
+	{
+		while (true)
+		{
+			vector<TraceRecord<T>> batch;
+			{
+				unique_lock<mutex> lock(batchesMutex);
+				batchReady.wait(lock, [&] { return !batches.empty() || finished; });
+
+				if (batches.empty())
+					return;
+
+				batch = move(batches.front());
+				batches.pop_front();
+				batchTaken.notify_one();
+			}
+
+			for (auto& record : batch)
+				Apply(record);
+		}
+	}
+};
+
+/**
+ * Replays a trace with keys of one type and prints the throughput and latencies.
+ * 
+ * \param stream The trace
+ * \param options The parameters of the replay
+ * \return False if the trace is corrupt
+ */
+template <class T>
+bool Replay(istream& stream, const Options& options)
+{
+	TraceReader<T> reader(stream);
+	vector<Partition<T>*> partitions;
+	for (int i = 0; i < options.threads; i++)
+		partitions.push_back(new Partition<T>(options.order, options.sampleEvery));
+
+	long long records = 0;
+	TraceRecord<T> record;
+	steady_clock::time_point start = steady_clock::now();
+
+	if (options.threads == 1)
+	{
+		// no hand over needed, the records are applied as they are read
+		while (reader.Read(record))
+		{
+			partitions[0]->Apply(record);
+			records++;
+		}
+	}
+	else
+	{
+		vector<thread> threads;
+		for (auto partition : partitions)
+			threads.emplace_back([partition] { partition->Run(); });
+
+		vector<vector<TraceRecord<T>>> batches(options.threads);
+
+		while (reader.Read(record))
+		{
+			records++;
+
+			// range operations touch every partition, the rest only the one owning the key
+			bool range = record.operation == TraceOperation::Scan || record.operation == TraceOperation::RemoveRange;
+			int first = range ? 0 : HashKey(record.key) % options.threads;
+			int last = range ? options.threads - 1 : first;
+
+			for (int i = first; i <= last; i++)
+			{
+				batches[i].push_back(record);
+				if (batches[i].size() == batchSize)
+					partitions[i]->Push(batches[i]);
+			}
+		}
+
+		for (int i = 0; i < options.threads; i++)
+		{
+			if (!batches[i].empty())
+				partitions[i]->Push(batches[i]);
+			partitions[i]->Finish();
+		}
+
+		for (auto& thread : threads)
+			thread.join();
+	}
+
+	double seconds = duration<double>(steady_clock::now() - start).count();
+
+	for (auto partition : partitions)
+		sink += partition->GetResults();
+
+	printf("Replay stats:\n");
+	printf("  Records: %lld\n", records);
+	printf("  Threads: %d\n", options.threads);
+	printf("  Seconds: %.3f\n", seconds);
+	printf("  Operations per second: %.0f\n", seconds > 0 ? records / seconds : 0.0);
+	printf("Latencies (ns, p50 / p99 / p99.9 / max):\n");
+
+	for (int i = 0; i < traceOperationCount; i++)
+	{
+		LatencyHistogram merged;
+		for (auto partition : partitions)
+			merged.Merge(partition->latencies[i]);
+
+		if (merged.GetCount() > 0)
+			printf("  %s: %lld / %lld / %lld / %lld (%lld samples)\n", operationNames[i], merged.GetPercentile(50),
+				merged.GetPercentile(99), merged.GetPercentile(99.9), merged.GetMax(), merged.GetCount());
+	}
+
+	for (auto partition : partitions)
+		delete partition;
+
+	if (reader.IsCorrupt())
+	{
+		printf("The trace is corrupt after %lld records\n", records);
+		return false;
+	}
+
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	Options options;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--order") == 0 && i + 1 < argc)
+			options.order = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+			options.threads = max(1, atoi(argv[++i]));
+		else if (strcmp(argv[i], "--sample") == 0 && i + 1 < argc)
+			options.sampleEvery = max(1, atoi(argv[++i]));
+		else if (argv[i][0] != '-' && options.path.empty())
+			options.path = argv[i];
+		else
+		{
+			options.path.clear();
+			break;
+		}
+	}
+
+	if (options.path.empty())
+	{
+		printf("usage: %s trace [--order 64] [--threads 1] [--sample 16]\n", argv[0]);
+		return 1;
+	}
+
+	ifstream stream(options.path, ios::binary);
+	if (!stream)
+	{
+		printf("Can't open %s\n", options.path.c_str());
+		return 1;
+	}
+
+	// the reader checks the header again, so the stream goes back to the start
+	TraceKeyType keyType = ReadTraceKeyType(stream);
+	stream.seekg(0);
+
+	bool replayed = false;
+	switch (keyType)
+	{
+	case TraceKeyType::Int32:
+		replayed = Replay<int>(stream, options);
+		break;
+	case TraceKeyType::Int64:
+		replayed = Replay<long long>(stream, options);
+		break;
+	case TraceKeyType::String:
+		replayed = Replay<string>(stream, options);
+		break;
+	case TraceKeyType::CountedInt32:
+		replayed = Replay<Counted<int>>(stream, options);
+		break;
+	case TraceKeyType::CountedInt64:
+		replayed = Replay<Counted<long long>>(stream, options);
+		break;
+	case TraceKeyType::CountedString:
+		replayed = Replay<Counted<string>>(stream, options);
+		break;
+	default:
+		printf("%s is not a trace\n", options.path.c_str());
+		break;
+	}
+
+	return replayed ? 0 : 1;
+}
@@ -0,0 +1,1189 @@
+/*****************************************************************//**
+ * \file   Tests.cpp
+ * \brief  Checks the tree against a plain map
+ *
+ * Every check builds the same trees in node mode, where the values are kept in nodes from the first insert,
+ * and in flat mode, where small trees stay in a single sorted array. Failed checks are printed
+ * and the exit code is the number of failures.
+ *
+ *   Tests
+ *
+ * \author Kkobari
+ * \date   November 2022
+ *********************************************************************/
+
+#include "../B-Treezy/BTree.h"
+#include "../B-Treezy/ShardedBTree.h"
+#include <map>
+#include <set>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <climits>
+#include <cstdio>
+#include <thread>
+
+using namespace std;
+
+/** The number of checks which failed */
+static int failures = 0;
+
+/**
+ * Records the result of a check and prints it if it failed.
+ *
+ * \param passed Whether the check passed
+ * \param name The name of the check
+ */
+static void Check(bool passed, const string& name)
+{
+	if (!passed)
+	{
+		cout << "FAILED: " << name << endl;
+		failures++;
+	}
+}
+
+/**
+ * Reads all keys of a counted tree with their counts.
+ *
+ * \param tree The tree
+ * \return The counts by key
+ */
+static map<int, long long> Contents(BTree<Counted<int>>* tree)
+{
+	map<int, long long> counts;
+	tree->ForEachRange(Counted<int>(INT_MIN), Counted<int>(INT_MAX), [&](const Counted<int>& value) { counts[value.key] += value.count; });
+	return counts;
+}
+
+/**
+ * Creates a counted tree of the given keys, each inserted as many times as its count.
+ *
+ * \param counts The counts by key
+ * \param flat Whether small trees are kept flat, otherwise the tree uses nodes from the start
+ * \return The tree
+ */
+static BTree<Counted<int>>* MakeCounted(const map<int, long long>& counts, bool flat)
+{
+	BTree<Counted<int>>* tree = new BTree<Counted<int>>(4);
+	if (!flat)
+		tree->SetFlatCapacity(0);
+
+	for (auto& entry : counts)
+		for (long long i = 0; i < entry.second; i++)
+			tree->Insert(Counted<int>(entry.first));
+
+	return tree;
+}
+
+/**
+ * Creates the counts of a range of keys, each key counted between 1 and 4 times.
+ *
+ * \param from The lowest key
+ * \param to The key after the highest one
+ * \param seed Changes which key gets which count
+ * \return The counts by key
+ */
+static map<int, long long> MakeCounts(int from, int to, int seed)
+{
+	map<int, long long> counts;
+	for (int key = from; key < to; key++)
+		counts[key] = (key * 7 + seed) % 4 + 1;
+	return counts;
+}
+
+/**
+ * Splits counted trees at every key and checks that the counts stay with their keys.
+ *
+ * \param flat Whether the trees are small enough to stay flat
+ */
+static void TestSplit(bool flat)
+{
+	string mode = flat ? " (flat)" : " (nodes)";
+	int size = flat ? 40 : 300;
+
+	map<int, long long> counts = MakeCounts(0, size, 1);
+
+	for (int key = 0; key <= size; key += flat ? 1 : 7)
+	{
+		BTree<Counted<int>>* lower = MakeCounted(counts, flat);
+		BTree<Counted<int>>* higher = lower->Split(Counted<int>(key));
+
+		map<int, long long> expectedLower(counts.begin(), counts.lower_bound(key));
+		map<int, long long> expectedHigher(counts.lower_bound(key), counts.end());
+
+		Check(Contents(lower) == expectedLower, "split lower part at " + to_string(key) + mode);
+		Check(Contents(higher) == expectedHigher, "split higher part at " + to_string(key) + mode);
+		if (key < size)
+			Check(higher->Count(Counted<int>(key)) == counts[key], "split keeps the count of the key " + to_string(key) + mode);
+
+		delete lower;
+		delete higher;
+	}
+}
+
+/**
+ * Unites, intersects and subtracts overlapping counted trees and checks the counts against maps.
+ *
+ * \param flat Whether the trees are small enough to stay flat
+ */
+static void TestSetOperations(bool flat)
+{
+	string mode = flat ? " (flat)" : " (nodes)";
+	int size = flat ? 30 : 400;
+
+	map<int, long long> a = MakeCounts(0, size, 1);
+	map<int, long long> b = MakeCounts(size / 2, size + size / 2, 2);
+
+	map<int, long long> expectedUnion = a;
+	map<int, long long> expectedIntersect;
+	map<int, long long> expectedDifference = a;
+	for (auto& entry : b)
+	{
+		expectedUnion[entry.first] += entry.second;
+
+		if (a.count(entry.first) == 0)
+			continue;
+
+		expectedIntersect[entry.first] = min(a[entry.first], entry.second);
+		expectedDifference[entry.first] -= entry.second;
+		if (expectedDifference[entry.first] <= 0)
+			expectedDifference.erase(entry.first);
+	}
+
+	BTree<Counted<int>>* first = MakeCounted(a, flat);
+	BTree<Counted<int>>* second = MakeCounted(b, flat);
+	BTree<Counted<int>>* result = BTree<Counted<int>>::Union(first, second);
+	Check(Contents(result) == expectedUnion, "union adds up the counts" + mode);
+	delete first;
+	delete second;
+	delete result;
+
+	first = MakeCounted(a, flat);
+	second = MakeCounted(b, flat);
+	result = BTree<Counted<int>>::Intersect(first, second);
+	Check(Contents(result) == expectedIntersect, "intersection keeps the lower counts" + mode);
+	delete first;
+	delete second;
+	delete result;
+
+	first = MakeCounted(a, flat);
+	second = MakeCounted(b, flat);
+	result = BTree<Counted<int>>::Difference(first, second);
+	Check(Contents(result) == expectedDifference, "difference subtracts the counts" + mode);
+	delete first;
+	delete second;
+	delete result;
+}
+
+/**
+ * Reads all values of a tree.
+ *
+ * \param tree The tree
+ * \return The values in ascending order
+ */
+static set<int> Contents(BTree<int>* tree)
+{
+	set<int> values;
+	tree->ForEachRange(INT_MIN, INT_MAX, [&](const int& value) { values.insert(value); });
+	return values;
+}
+
+/**
+ * Creates a tree kept in nodes with the keys of a range, then removes all but every eighth key
+ * with relaxed deletion, which leaves many nodes below the regular minimum.
+ *
+ * \param from The lowest key
+ * \param to The key after the highest one
+ * \param kept The keys left in the tree
+ * \param order The order of the tree
+ * \return The tree
+ */
+static BTree<int>* MakeThinned(int from, int to, set<int>& kept, int order = 5)
+{
+	BTree<int>* tree = new BTree<int>(order);
+	tree->SetFlatCapacity(0);
+	tree->SetRelaxedDeletion(true);
+
+	for (int key = from; key < to; key++)
+		tree->Insert(key);
+
+	kept.clear();
+	for (int key = from; key < to; key++)
+	{
+		if (key % 8 != 0)
+			tree->Remove(key);
+		else
+			kept.insert(key);
+	}
+
+	return tree;
+}
+
+/**
+ * Removes most keys with relaxed deletion, compacts the tree a few nodes at a time with more removes
+ * in between, and checks that the result holds the right values and meets the regular minimum again.
+ */
+static void TestIncrementalCompact()
+{
+	for (int order : { 5, 8, 16 })
+	{
+		string name = " (order " + to_string(order) + ")";
+
+		set<int> kept;
+		BTree<int>* tree = MakeThinned(0, 5000, kept, order);
+		Check(tree->Validate(), "a thinned relaxed tree is valid" + name);
+
+		int calls = 0;
+		while (!tree->Compact(8))
+		{
+			calls++;
+
+			// the tree keeps changing while it is compacted
+			if (calls % 4 == 0 && !kept.empty())
+			{
+				int key = *kept.begin();
+				tree->Remove(key);
+				kept.erase(key);
+			}
+		}
+		Check(calls > 1, "compaction is spread over several calls" + name);
+		Check(Contents(tree) == kept, "compaction keeps the values" + name);
+
+		// with relaxed deletion off, Validate checks the regular minimum
+		tree->SetRelaxedDeletion(false);
+		Check(tree->Validate(), "compaction restores the regular minimum" + name);
+		Check(tree->Compact(1), "a compacted tree has nothing left to fix" + name);
+
+		delete tree;
+	}
+}
+
+/**
+ * Splits, joins and combines trees thinned out by relaxed deletion, alone and together with regular trees,
+ * and checks the contents and the structure of the results.
+ */
+static void TestRelaxedCombine()
+{
+	set<int> lowerKept, higherKept;
+	BTree<int>* lower = MakeThinned(0, 3000, lowerKept);
+	BTree<int>* higher = lower->Split(1500);
+	set<int> expectedLower(lowerKept.begin(), lowerKept.lower_bound(1500));
+	set<int> expectedHigher(lowerKept.lower_bound(1500), lowerKept.end());
+
+	Check(lower->Validate() && higher->Validate(), "split of a relaxed tree keeps relaxed deletion in both parts");
+	Check(Contents(lower) == expectedLower && Contents(higher) == expectedHigher, "split of a relaxed tree keeps the values");
+
+	BTree<int>* joined = BTree<int>::Join(lower, 1501, higher);
+	lowerKept.insert(1501);
+	Check(joined->Validate(), "join of relaxed trees keeps relaxed deletion");
+	Check(Contents(joined) == lowerKept, "join of relaxed trees keeps the values");
+	delete lower;
+	delete higher;
+	delete joined;
+
+	for (int operation = 0; operation < 3; operation++)
+	{
+		for (bool firstRelaxed : { true, false })
+		{
+			string name = string(operation == 0 ? "union" : operation == 1 ? "intersection" : "difference")
+				+ (firstRelaxed ? " of relaxed trees" : " of a regular and a relaxed tree");
+
+			set<int> a, b;
+			BTree<int>* first;
+			if (firstRelaxed)
+			{
+				first = MakeThinned(0, 3000, a);
+			}
+			else
+			{
+				first = new BTree<int>(5);
+				first->SetFlatCapacity(0);
+				for (int key = 0; key < 3000; key += 3)
+				{
+					first->Insert(key);
+					a.insert(key);
+				}
+			}
+			BTree<int>* second = MakeThinned(1000, 4000, b);
+
+			set<int> expected;
+			if (operation == 0)
+			{
+				expected = a;
+				expected.insert(b.begin(), b.end());
+			}
+			for (int key : a)
+			{
+				if (operation == 1 && b.count(key) > 0)
+					expected.insert(key);
+				if (operation == 2 && b.count(key) == 0)
+					expected.insert(key);
+			}
+
+			BTree<int>* result = operation == 0 ? BTree<int>::Union(first, second)
+				: operation == 1 ? BTree<int>::Intersect(first, second) : BTree<int>::Difference(first, second);
+
+			// a regular first tree makes a regular result, with the nodes of the relaxed one compacted
+			Check(result->Validate(), name + " has the structure of its deletion mode");
+			Check(Contents(result) == expected, name + " has the right values");
+
+			delete first;
+			delete second;
+			delete result;
+		}
+	}
+}
+
+/**
+ * Checks the range aggregates of a tree against the values of a plain set folded one by one.
+ *
+ * \param tree The tree
+ * \param values The values the tree should hold
+ * \param random The generator of the ranges
+ * \param name The name of the checks
+ */
+template <class Monoid>
+static void CheckAggregates(BTree<int, Monoid>* tree, const set<int>& values, mt19937& random, const string& name)
+{
+	uniform_int_distribution<int> bound(-10, 2010);
+
+	for (int i = 0; i < 50; i++)
+	{
+		int lo = bound(random);
+		int hi = bound(random);
+
+		typename Monoid::Value expected = Monoid::Identity();
+		for (auto it = values.lower_bound(lo); it != values.end() && *it <= hi; ++it)
+			expected = Monoid::Combine(expected, Monoid::Lift(*it));
+
+		if (tree->Aggregate(lo, hi) != expected)
+		{
+			Check(false, name + " between " + to_string(lo) + " and " + to_string(hi));
+			return;
+		}
+	}
+}
+
+/**
+ * Inserts, removes and removes ranges of random values and checks the range aggregates after each step.
+ *
+ * \param flat Whether the tree is small enough to stay flat
+ * \param monoid The name of the monoid
+ */
+template <class Monoid>
+static void TestAggregate(bool flat, const string& monoid)
+{
+	string name = monoid + (flat ? " (flat)" : " (nodes)");
+	int size = flat ? 60 : 1500;
+
+	BTree<int, Monoid>* tree = new BTree<int, Monoid>(4);
+	if (!flat)
+		tree->SetFlatCapacity(0);
+	set<int> values;
+	mt19937 random(7);
+	uniform_int_distribution<int> key(0, 1999);
+
+	for (int i = 0; i < size; i++)
+	{
+		int value = key(random);
+		if (values.insert(value).second)
+			tree->Insert(value);
+	}
+	CheckAggregates(tree, values, random, name + " after inserts");
+
+	for (int i = 0; i < size / 3; i++)
+	{
+		int value = key(random);
+		if (values.erase(value) > 0)
+			tree->Remove(value);
+	}
+	CheckAggregates(tree, values, random, name + " after removes");
+
+	for (int i = 0; i < 5; i++)
+	{
+		int lo = key(random);
+		int hi = lo + 100;
+		tree->RemoveRange(lo, hi);
+		values.erase(values.lower_bound(lo), values.upper_bound(hi));
+	}
+	CheckAggregates(tree, values, random, name + " after range removes");
+
+	delete tree;
+}
+
+/**
+ * Checks that the count aggregate of counted keys adds up their counts.
+ *
+ * \param flat Whether the tree is small enough to stay flat
+ */
+static void TestCountedAggregate(bool flat)
+{
+	string mode = flat ? " (flat)" : " (nodes)";
+	int size = flat ? 40 : 500;
+
+	BTree<Counted<int>, CountAggregate<Counted<int>>>* tree = new BTree<Counted<int>, CountAggregate<Counted<int>>>(4);
+	if (!flat)
+		tree->SetFlatCapacity(0);
+
+	map<int, long long> counts = MakeCounts(0, size, 3);
+	for (auto& entry : counts)
+		tree->Insert(Counted<int>(entry.first, entry.second));
+	for (int key = 0; key < size; key += 3)
+	{
+		tree->Remove(Counted<int>(key));
+		if (--counts[key] == 0)
+			counts.erase(key);
+	}
+	long long inRange = 0;
+	for (auto it = counts.lower_bound(size / 2); it != counts.upper_bound(size / 2 + size / 10); ++it)
+		inRange += it->second;
+	long long removed = tree->RemoveRange(Counted<int>(size / 2), Counted<int>(size / 2 + size / 10));
+	Check(removed == inRange, "range remove of counted keys returns the sum of their counts" + mode);
+	counts.erase(counts.lower_bound(size / 2), counts.upper_bound(size / 2 + size / 10));
+
+	for (int lo = -1; lo <= size; lo += flat ? 1 : 13)
+	{
+		int hi = lo + size / 4;
+		long long expected = 0;
+		for (auto it = counts.lower_bound(lo); it != counts.end() && it->first <= hi; ++it)
+			expected += it->second;
+
+		Check(tree->Aggregate(Counted<int>(lo), Counted<int>(hi)) == expected, "count of counted keys between " + to_string(lo) + " and " + to_string(hi) + mode);
+	}
+
+	delete tree;
+}
+
+/**
+ * Defragments a random tree in both orders, at once and in steps with changes in between, then changes it
+ * further, so new nodes are allocated on their own and arenas are freed with their last node, and checks
+ * the values, the structure and the memory accounting against a plain set.
+ */
+static void TestDefragment()
+{
+	for (DefragmentOrder order : { DefragmentOrder::BreadthFirst, DefragmentOrder::VanEmdeBoas })
+	{
+		string name = order == DefragmentOrder::BreadthFirst ? " (breadth first)" : " (van Emde Boas)";
+
+		BTree<int>* tree = new BTree<int>(8);
+		tree->SetFlatCapacity(0);
+		set<int> values;
+		mt19937 random(9);
+		uniform_int_distribution<int> key(0, 99999);
+
+		for (int i = 0; i < 20000; i++)
+		{
+			int value = key(random);
+			if (values.insert(value).second)
+				tree->Insert(value);
+		}
+
+		TreeMemoryUsage before = tree->MemoryUsage();
+		Check(tree->Defragment(order), "a pass without a limit finishes at once" + name);
+
+		TreeMemoryUsage after = tree->MemoryUsage();
+		Check(tree->Validate() && Contents(tree) == values, "defragmenting keeps the values" + name);
+		Check(after.keyStorage == before.keyStorage && after.keyStorage == values.size() * sizeof(int), "defragmenting keeps the key storage" + name);
+		Check(after.slack == 0 && before.slack > 0, "a full pass leaves no slack" + name);
+
+		// the nodes allocated on their own and the slots of deleted nodes show up as slack again
+		for (int i = 0; i < 10000; i++)
+		{
+			int value = key(random);
+			if (i % 2 == 0 && values.insert(value).second)
+				tree->Insert(value);
+			else if (i % 2 == 1 && values.erase(value) > 0)
+				tree->Remove(value);
+		}
+		Check(tree->Validate() && Contents(tree) == values, "a defragmented tree keeps working" + name);
+		Check(tree->MemoryUsage().keyStorage == values.size() * sizeof(int), "memory accounting follows the changes" + name);
+		Check(tree->MemoryUsage().slack > 0, "changes after defragmenting leave slack" + name);
+
+		// a pass in steps, with the tree changing between them
+		int steps = 0;
+		while (!tree->Defragment(order, 16))
+		{
+			steps++;
+
+			int value = key(random);
+			if (steps % 2 == 0 && values.insert(value).second)
+				tree->Insert(value);
+			else if (steps % 2 == 1 && values.erase(value) > 0)
+				tree->Remove(value);
+		}
+		Check(steps > 1, "a limited pass takes several steps" + name);
+		Check(tree->Validate() && Contents(tree) == values, "defragmenting in steps keeps the values" + name);
+
+		// removing everything frees every arena
+		for (int value : values)
+			tree->Remove(value);
+		Check(tree->MemoryUsage().Total() == 0, "an emptied tree holds no memory" + name);
+
+		delete tree;
+	}
+}
+
+/**
+ * Exports a tree with cold subtrees in every format and checks that the output matches the one
+ * of the thawed tree, and that the export left the subtrees cold.
+ */
+static void TestColdExport()
+{
+	BTree<int>* tree = new BTree<int>(4);
+	tree->SetFlatCapacity(0);
+	for (int i = 0; i < 3000; i++)
+		tree->Insert(i * 3);
+
+	// every subtree not used by the last operation is made cold
+	tree->SetTiering(1, 1);
+	tree->Find(0);
+	tree->FreezeCold();
+
+	size_t cold = tree->MemoryUsage().coldBlocks;
+	Check(cold > 0, "the tree has cold subtrees to export");
+
+	vector<string> exported;
+	for (ExportFormat format : { ExportFormat::Outline, ExportFormat::Dot, ExportFormat::Json })
+	{
+		ExportOptions options;
+		options.format = format;
+
+		ostringstream stream;
+		tree->Export(stream, options);
+		exported.push_back(stream.str());
+	}
+	Check(tree->MemoryUsage().coldBlocks == cold, "export keeps the subtrees cold");
+
+	tree->SetTiering(0);
+	tree->ThawAll();
+
+	for (int i = 0; i < (int)exported.size(); i++)
+	{
+		ExportOptions options;
+		options.format = (ExportFormat)i;
+
+		ostringstream stream;
+		tree->Export(stream, options);
+		Check(stream.str() == exported[i], "export of cold subtrees matches the thawed tree, format " + to_string(i));
+	}
+
+	delete tree;
+}
+
+/**
+ * Splits and joins a tree with a memory budget and checks that the resulting trees keep the budget,
+ * so their unused subtrees are made cold as well.
+ */
+static void TestTieringSettings()
+{
+	BTree<int>* lower = new BTree<int>(4);
+	lower->SetFlatCapacity(0);
+	set<int> values;
+	for (int i = 0; i < 3000; i++)
+	{
+		lower->Insert(i * 3);
+		values.insert(i * 3);
+	}
+
+	// every subtree not used by the last operation is made cold on every operation
+	lower->SetTiering(1, 1);
+
+	BTree<int>* higher = lower->Split(4500);
+	lower->Find(0);
+	higher->Find(4500);
+	Check(lower->MemoryUsage().coldBlocks > 0 && higher->MemoryUsage().coldBlocks > 0, "both parts of a split keep the memory budget");
+
+	BTree<int>* joined = BTree<int>::Join(lower, 4499, higher);
+	values.insert(4499);
+	joined->Find(0);
+	Check(joined->MemoryUsage().coldBlocks > 0, "a joined tree keeps the memory budget");
+	Check(joined->Validate() && Contents(joined) == values, "a joined tree with cold subtrees keeps its values");
+
+	delete lower;
+	delete higher;
+	delete joined;
+}
+
+/**
+ * Exports string keys with quotes, backslashes and control characters and checks they are escaped for each format.
+ */
+static void TestExportEscaping()
+{
+	BTree<string>* tree = new BTree<string>(4);
+	tree->Insert("a\"b");
+	tree->Insert("c\\d");
+	tree->Insert(string("e\x01" "f"));
+
+	ExportOptions options;
+	options.format = ExportFormat::Dot;
+	ostringstream dot;
+	tree->Export(dot, options);
+	Check(dot.str().find("a\\\"b c\\\\d e\\\\x01f") != string::npos, "DOT labels escape quotes, backslashes and control characters");
+
+	options.format = ExportFormat::Json;
+	ostringstream json;
+	tree->Export(json, options);
+	Check(json.str().find("[\"a\\\"b\",\"c\\\\d\",\"e\\u0001f\"]") != string::npos, "JSON strings escape quotes, backslashes and control characters");
+
+	delete tree;
+}
+
+/**
+ * Checks whether two keys read from a trace are the same, counted keys also by their count.
+ */
+template <class T>
+static bool SameKey(const T& a, const T& b)
+{
+	return a == b;
+}
+
+template <class K>
+static bool SameKey(const Counted<K>& a, const Counted<K>& b)
+{
+	return a.key == b.key && a.count == b.count;
+}
+
+/**
+ * Writes records into a trace and reads them back, whole and cut short.
+ *
+ * \param keys The keys, each written as a single key operation and as the low end of a range operation with the next key
+ * \param keyType The key type the trace should report
+ * \param name The name of the checks
+ */
+template <class T>
+static void CheckTraceRoundTrip(const vector<T>& keys, TraceKeyType keyType, const string& name)
+{
+	vector<TraceRecord<T>> records;
+	for (int i = 0; i < (int)keys.size(); i++)
+	{
+		TraceOperation single = (TraceOperation)(i % 3);
+		TraceOperation range = i % 2 == 0 ? TraceOperation::Scan : TraceOperation::RemoveRange;
+		records.push_back(TraceRecord<T>{ single, keys[i], T() });
+		records.push_back(TraceRecord<T>{ range, keys[i], keys[(i + 1) % keys.size()] });
+	}
+
+	ostringstream written;
+	{
+		TraceWriter<T> writer(written);
+		for (auto& record : records)
+		{
+			if (record.operation == TraceOperation::Scan || record.operation == TraceOperation::RemoveRange)
+				writer.Write(record.operation, record.key, record.high);
+			else
+				writer.Write(record.operation, record.key);
+		}
+		Check(writer.GetRecordCount() == records.size(), "trace writer counts the records of " + name);
+	}
+
+	istringstream typeStream(written.str());
+	Check(ReadTraceKeyType(typeStream) == keyType, "trace header holds the key type of " + name);
+
+	istringstream stream(written.str());
+	TraceReader<T> reader(stream);
+	TraceRecord<T> record;
+	bool same = true;
+	size_t count = 0;
+	while (reader.Read(record))
+	{
+		if (count < records.size())
+		{
+			const TraceRecord<T>& expected = records[count];
+			bool range = expected.operation == TraceOperation::Scan || expected.operation == TraceOperation::RemoveRange;
+			same = same && record.operation == expected.operation && SameKey(record.key, expected.key) && (!range || SameKey(record.high, expected.high));
+		}
+		count++;
+	}
+	Check(same && count == records.size() && !reader.IsCorrupt(), "trace of " + name + " reads back the written records");
+
+	// a record cut in half is reported
+	string cut = written.str();
+	cut.pop_back();
+	istringstream cutStream(cut);
+	TraceReader<T> cutReader(cutStream);
+	while (cutReader.Read(record))
+		continue;
+	Check(cutReader.IsCorrupt(), "trace of " + name + " cut short is corrupt");
+}
+
+/**
+ * Writes and reads traces of every key type, with keys jumping up and down across the whole range
+ * of the integers, so the differences wrap around, and enough records to span several blocks.
+ */
+static void TestTraceRoundTrip()
+{
+	mt19937_64 random(3);
+
+	vector<int> ints = { 0, -1, 1, INT_MIN, INT_MAX, INT_MIN, -5, 7 };
+	vector<long long> longs = { 0, LLONG_MIN, LLONG_MAX, -1, LLONG_MIN, 1, LLONG_MAX, -42 };
+	for (int i = 0; i < 20000; i++)
+	{
+		ints.push_back((int)random());
+		longs.push_back(i % 2 == 0 ? (long long)random() : -(long long)(random() % 1000));
+	}
+	CheckTraceRoundTrip(ints, TraceKeyType::Int32, "int keys");
+	CheckTraceRoundTrip(longs, TraceKeyType::Int64, "long long keys");
+
+	vector<string> strings = { "", "a", string(100000, 'x'), string("\0\xff\n", 3), "b" };
+	for (int i = 0; i < 5000; i++)
+		strings.push_back("key" + to_string(random() % 100000));
+	CheckTraceRoundTrip(strings, TraceKeyType::String, "string keys");
+
+	vector<Counted<int>> countedInts;
+	vector<Counted<string>> countedStrings;
+	for (int i = 0; i < 5000; i++)
+	{
+		long long count = i % 7 == 0 ? (1LL << 40) + i : 1 + i % 5;
+		countedInts.push_back(Counted<int>(i % 2 == 0 ? INT_MIN + i : INT_MAX - i, count));
+		countedStrings.push_back(Counted<string>(to_string(random()), count));
+	}
+	CheckTraceRoundTrip(countedInts, TraceKeyType::CountedInt32, "counted int keys");
+	CheckTraceRoundTrip(countedStrings, TraceKeyType::CountedString, "counted string keys");
+}
+
+/**
+ * Counts with BTREE_COUNT the way the tree does, to check that the amount is not even evaluated
+ * when the counters are compiled out.
+ */
+struct CountingProbe
+{
+	BTreeCounters counters;
+	int evaluated = 0;
+
+	void Count()
+	{
+		BTREE_COUNT(comparisons, ++this->evaluated);
+	}
+};
+
+/**
+ * Checks the counters of finds in a known tree: exact with BTREE_INSTRUMENTATION defined (as the test
+ * project builds), all zero and free otherwise.
+ */
+static void TestCounters()
+{
+	// root [2] with the leaves [1] and [3, 4]
+	BTree<int>* tree = new BTree<int>(4);
+	tree->SetFlatCapacity(0);
+	for (int i = 1; i <= 4; i++)
+		tree->Insert(i);
+	tree->ResetCounters();
+
+	tree->Find(4);
+	BTreeCounters found = tree->GetCounters();
+	tree->Find(0);
+	BTreeCounters total = tree->GetCounters();
+
+	CountingProbe probe;
+	probe.Count();
+
+#ifdef BTREE_INSTRUMENTATION
+	// 4: one comparison against 2 to find it missing, one to pick the right child, then 3 and 4
+	Check(found.operations == 1 && found.nodesVisited == 2 && found.comparisons == 4, "counters of a find that hits");
+	// 0: the same two at the root, then 1 to find it missing in the leaf
+	Check(total.operations == 2 && total.nodesVisited == 4 && total.comparisons == 7, "counters of a find that misses");
+	Check(total.splits == 0 && total.allocations == 0, "finds count no structural changes");
+	Check(probe.evaluated == 1 && probe.counters.comparisons == 1, "counting adds the amount");
+
+	tree->ResetCounters();
+	tree->Insert(5);
+	tree->Insert(6);
+	BTreeCounters inserted = tree->GetCounters();
+	Check(inserted.operations == 2 && inserted.splits == 1 && inserted.allocations == 1, "counters of an insert that splits");
+#else
+	Check(found.comparisons == 0 && total.operations == 0 && total.nodesVisited == 0 && total.comparisons == 0, "counters compiled out stay zero");
+	Check(probe.evaluated == 0 && probe.counters.comparisons == 0, "counters compiled out cost nothing");
+#endif
+
+	delete tree;
+}
+
+/**
+ * Interleaves the operations of two recorders on one thread and checks that each samples its own share,
+ * also for recorders created after others were destroyed.
+ */
+static void TestLatencySampling()
+{
+	for (int round = 0; round < 3; round++)
+	{
+		LatencyRecorder first(2);
+		LatencyRecorder second(2);
+
+		int firstSampled = 0, secondSampled = 0;
+		for (int i = 0; i < 100; i++)
+		{
+			firstSampled += first.ShouldSample();
+			secondSampled += second.ShouldSample();
+		}
+
+		Check(firstSampled == 50 && secondSampled == 50, "each recorder samples every second operation of its own, round " + to_string(round));
+	}
+}
+
+/**
+ * Bulk loads unsorted values with duplicates on a pool of workers, into empty and filled trees, and checks
+ * the trees and parallel range scans of them against trees built by inserting the values one by one.
+ *
+ * \param flat Whether the trees are small enough to stay flat
+ */
+static void TestParallelBulkLoad(bool flat)
+{
+	string mode = flat ? " (flat)" : " (nodes)";
+	int size = flat ? 100 : 50000;
+
+	ThreadPool pool(4);
+	mt19937 random(5);
+	uniform_int_distribution<int> key(0, size / 2);
+
+	// values already in the tree are kept along the loaded ones
+	vector<int> present, loaded;
+	for (int i = 0; i < size / 4; i++)
+		present.push_back(key(random));
+	for (int i = 0; i < size; i++)
+		loaded.push_back(key(random));
+
+	BTree<int>* serial = new BTree<int>(16);
+	BTree<int>* parallel = new BTree<int>(16);
+	for (int value : present)
+	{
+		serial->TryInsert(value);
+		parallel->TryInsert(value);
+	}
+	for (int value : loaded)
+		serial->TryInsert(value);
+	parallel->BulkLoad(loaded, &pool);
+
+	Check(parallel->IsFlat() == flat && parallel->Validate(), "a parallel bulk load builds a valid tree" + mode);
+	Check(Contents(parallel) == Contents(serial), "a parallel bulk load drops duplicates like single inserts" + mode);
+
+	// random ranges, some of them overlapping or empty
+	vector<pair<int, int>> ranges;
+	for (int i = 0; i < 64; i++)
+	{
+		int lo = key(random);
+		ranges.push_back(make_pair(lo, lo + (int)(random() % (size / 8)) - size / 64));
+	}
+
+	vector<vector<int>> scanned(ranges.size()), expected(ranges.size());
+	parallel->ParallelForEachRange(ranges, [&](int range, const int& value) { scanned[range].push_back(value); }, &pool);
+	for (int i = 0; i < (int)ranges.size(); i++)
+		serial->ForEachRange(ranges[i].first, ranges[i].second, [&](const int& value) { expected[i].push_back(value); });
+	Check(scanned == expected, "parallel range scans match serial scans" + mode);
+
+	delete serial;
+	delete parallel;
+
+	// duplicates of counted values are counted together
+	BTree<Counted<int>>* counted = new BTree<Counted<int>>(16);
+	map<int, long long> counts;
+	vector<Counted<int>> countedLoaded;
+	for (int value : loaded)
+	{
+		countedLoaded.push_back(Counted<int>(value));
+		counts[value]++;
+	}
+	counted->BulkLoad(countedLoaded, &pool);
+	Check(Contents(counted) == counts, "a parallel bulk load adds up the counts of duplicates" + mode);
+	delete counted;
+}
+
+/**
+ * Throws from some iterations of a parallel loop and checks that the loop still finishes,
+ * runs the other iterations and throws on the calling thread.
+ */
+static void TestParallelForException()
+{
+	ThreadPool pool(4);
+	atomic<int> finished(0);
+	bool thrown = false;
+
+	try
+	{
+		pool.ParallelFor(64, [&](int i)
+		{
+			if (i % 16 == 3)
+				throw runtime_error("iteration " + to_string(i));
+			finished++;
+		});
+	}
+	catch (const runtime_error&)
+	{
+		thrown = true;
+	}
+
+	Check(thrown, "a throwing iteration is thrown again by the parallel loop");
+	Check(finished == 60, "the other iterations run despite the exception");
+
+	// the workers survived and take new tasks
+	finished = 0;
+	pool.ParallelFor(8, [&](int) { finished++; });
+	Check(finished == 8, "the pool keeps working after an exception");
+}
+
+/**
+ * Writes a tree into a page file and checks many lookups and scans in flight at once against the tree,
+ * through io_uring (where the kernel supports it) and through the thread pool.
+ */
+static void TestPagedReads()
+{
+	BTree<int>* tree = new BTree<int>(16);
+	mt19937 random(11);
+	for (int i = 0; i < 5000; i++)
+		tree->TryInsert(random() % 100000);
+
+	// small pages, so the lookups go down a few levels
+	string path = "Tests.pages";
+	Check(tree->WritePages(path, 256), "the tree is written into pages");
+
+	for (bool useUring : { true, false })
+	{
+		PagedTree<int> paged;
+		if (!paged.Open(path, 8, useUring))
+		{
+			Check(false, "the page file opens");
+			continue;
+		}
+		string backend = string(" (") + paged.GetBackendName() + ")";
+
+		int values = 0;
+		tree->ForEachRange(INT_MIN, INT_MAX, [&](const int&) { values++; });
+		Check(paged.GetValueCount() == values, "the page file holds every value" + backend);
+
+		int mismatches = 0;
+		for (int i = 0; i < 2000; i++)
+		{
+			int key = random() % 100000;
+			bool expected = tree->Find(key);
+			paged.FindAsync(key, [&mismatches, expected](bool found) { mismatches += found != expected; });
+		}
+		paged.Run();
+		Check(mismatches == 0, "paged lookups match the tree" + backend);
+
+		vector<vector<int>> scanned(20), expected(20);
+		vector<bool> succeeded(20, false);
+		for (int i = 0; i < 20; i++)
+		{
+			int lo = random() % 100000 - 1000;
+			int hi = lo + random() % 20000;
+			tree->ForEachRange(lo, hi, [&](const int& value) { expected[i].push_back(value); });
+			paged.ScanAsync(lo, hi, 4, [&scanned, i](const int& value) { scanned[i].push_back(value); }, [&succeeded, i](bool result) { succeeded[i] = result; });
+		}
+		paged.Run();
+		Check(succeeded == vector<bool>(20, true) && scanned == expected, "paged scans match the tree" + backend);
+	}
+
+	remove(path.c_str());
+	delete tree;
+}
+
+/**
+ * Reads all values of a sharded tree, across the shards.
+ *
+ * \param tree The tree
+ * \return The values in the order they were visited
+ */
+static vector<int> Contents(ShardedBTree<int>* tree)
+{
+	vector<int> values;
+	tree->ForEachRange(INT_MIN, INT_MAX, [&](const int& value) { values.push_back(value); });
+	return values;
+}
+
+/**
+ * Inserts and removes disjoint keys from several threads while the shards split under them,
+ * then checks every value across the shards.
+ */
+static void TestShardedConcurrentWrites()
+{
+	const int threadCount = 4;
+	const int perThread = 20000;
+
+	ShardedBTree<int>* tree = new ShardedBTree<int>(16, threadCount);
+	tree->SetRebalancing(1024);
+
+	vector<thread> threads;
+	for (int t = 0; t < threadCount; t++)
+	{
+		threads.emplace_back([tree, t]()
+		{
+			vector<int> keys;
+			for (int i = 0; i < perThread; i++)
+				keys.push_back(i * threadCount + t);
+			shuffle(keys.begin(), keys.end(), mt19937(t));
+
+			for (int key : keys)
+				tree->Insert(key);
+			for (int key : keys)
+			{
+				if (key % 3 == 0)
+					tree->Remove(key);
+			}
+		});
+	}
+	for (thread& worker : threads)
+		worker.join();
+
+	vector<int> expected;
+	for (int key = 0; key < threadCount * perThread; key++)
+	{
+		if (key % 3 != 0)
+			expected.push_back(key);
+	}
+
+	Check(Contents(tree) == expected, "concurrent writes keep every value in order across the shards");
+	Check(tree->GetShardCount() > 1 && tree->GetRebalanceCount() > 0, "concurrent writes split the shards");
+	Check(tree->Find(1) && !tree->Find(3) && !tree->Find(threadCount * perThread), "finds route to the right shard");
+
+	delete tree;
+}
+
+/**
+ * Rebalances on request while the writes move to new ranges: first splitting the shard taking the writes,
+ * then, with all shards in use, merging the two coldest ones, once with the boundary between them
+ * still in the right shard and once after it was removed.
+ */
+static void TestShardedRebalance()
+{
+	ShardedBTree<int>* tree = new ShardedBTree<int>(8, 4);
+	tree->SetRebalancing(0);
+	set<int> values;
+
+	for (int i = 0; i < 1000; i++)
+	{
+		tree->Insert(i);
+		values.insert(i);
+	}
+	Check(tree->GetShardCount() == 1, "no rebalancing without a request");
+	Check(tree->Rebalance() && tree->GetShardCount() == 2, "a requested rebalance splits the written shard");
+
+	// all writes land past the split
+	for (int i = 10000; i < 11000; i++)
+	{
+		tree->Insert(i);
+		values.insert(i);
+	}
+	Check(tree->Rebalance() && tree->GetShardCount() == 3, "skewed writes split the hot shard");
+	Check(Contents(tree) == vector<int>(values.begin(), values.end()), "splitting the shards keeps the values");
+
+	for (bool boundaryPresent : { true, false })
+	{
+		string name = boundaryPresent ? " (boundary present)" : " (boundary absent)";
+
+		ShardedBTree<int>* full = new ShardedBTree<int>(8, 3);
+		full->SetRebalancing(0);
+
+		// three shards starting at 0, 1000 and 2000
+		vector<int> loaded;
+		for (int i = 0; i < 3000; i++)
+			loaded.push_back(i);
+		full->BulkLoad(loaded);
+		set<int> expected(loaded.begin(), loaded.end());
+
+		if (!boundaryPresent)
+		{
+			full->Remove(1000);
+			expected.erase(1000);
+		}
+
+		for (int i = 3000; i < 3200; i++)
+		{
+			full->Insert(i);
+			expected.insert(i);
+		}
+
+		long long rebalances = full->GetRebalanceCount();
+		Check(full->GetShardCount() == 3 && full->Rebalance(), "a skewed shard is split with all shards in use" + name);
+		Check(full->GetShardCount() == 3 && full->GetRebalanceCount() == rebalances + 2, "the coldest shards are merged" + name);
+		Check(Contents(full) == vector<int>(expected.begin(), expected.end()), "merging the shards keeps the values" + name);
+		Check(full->Find(999) && full->Find(1000) == boundaryPresent && full->Find(1001), "the boundary is only found if it was present" + name);
+
+		// the merged range takes writes again
+		full->Insert(1000 + boundaryPresent * 5000);
+		expected.insert(1000 + boundaryPresent * 5000);
+		full->Remove(500);
+		expected.erase(500);
+		Check(Contents(full) == vector<int>(expected.begin(), expected.end()), "the merged shard keeps working" + name);
+
+		delete full;
+	}
+
+	delete tree;
+}
+
+/**
+ * Bulk loads unsorted values with duplicates into a sharded tree kept in one shard and into one cut into several,
+ * then loads more into the existing shards.
+ */
+static void TestShardedBulkLoad()
+{
+	mt19937 random(13);
+	vector<int> loaded;
+	for (int i = 0; i < 20000; i++)
+		loaded.push_back(random() % 15000);
+	set<int> expected(loaded.begin(), loaded.end());
+
+	for (int maxShards : { 1, 4 })
+	{
+		string name = " (" + to_string(maxShards) + " shards)";
+
+		ShardedBTree<int>* tree = new ShardedBTree<int>(16, maxShards);
+		tree->BulkLoad(loaded);
+		Check(tree->GetShardCount() == maxShards, "bulk loading cuts the shards" + name);
+		Check(Contents(tree) == vector<int>(expected.begin(), expected.end()), "bulk loading drops the duplicates" + name);
+
+		vector<int> more;
+		for (int i = 0; i < 5000; i++)
+			more.push_back(random() % 30000);
+		tree->BulkLoad(more);
+		set<int> all = expected;
+		all.insert(more.begin(), more.end());
+		Check(tree->GetShardCount() == maxShards && Contents(tree) == vector<int>(all.begin(), all.end()), "bulk loading again keeps the values" + name);
+
+		delete tree;
+	}
+
+	// equal values stay in one shard, so mostly equal values make fewer shards
+	vector<int> equal(1000, 7);
+	equal.push_back(9);
+	equal.push_back(3);
+
+	ShardedBTree<int>* tree = new ShardedBTree<int>(16, 4);
+	tree->BulkLoad(equal);
+	Check(tree->GetShardCount() == 2 && Contents(tree) == vector<int>{ 3, 7, 9 }, "equal values are not cut apart");
+	delete tree;
+}
+
+int main()
+{
+	for (bool flat : { false, true })
+	{
+		TestSplit(flat);
+		TestSetOperations(flat);
+		TestAggregate<SumAggregate<int>>(flat, "sum");
+		TestAggregate<MinAggregate<int>>(flat, "minimum");
+		TestAggregate<MaxAggregate<int>>(flat, "maximum");
+		TestAggregate<CountAggregate<int>>(flat, "count");
+		TestCountedAggregate(flat);
+		TestParallelBulkLoad(flat);
+	}
+
+	TestIncrementalCompact();
+	TestRelaxedCombine();
+	TestDefragment();
+	TestColdExport();
+	TestTieringSettings();
+	TestExportEscaping();
+	TestTraceRoundTrip();
+	TestCounters();
+	TestLatencySampling();
+	TestParallelForException();
+	TestPagedReads();
+	TestShardedConcurrentWrites();
+	TestShardedRebalance();
+	TestShardedBulkLoad();
+
+	if (failures == 0)
+		cout << "all tests passed" << endl;
+
+	return failures;
+}